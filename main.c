@@ -1,7 +1,41 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <SDL2/SDL.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __linux__
+#include <execinfo.h>
+#include <sched.h>
+#include <signal.h>
+#endif
+
+#ifdef __unix__
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 typedef struct
 {
@@ -10,10 +44,22 @@ typedef struct
 }
 Point;
 
+// An integer grid cell. Positions are a cell plus a float sub-cell offset so that
+// precision stays the same no matter how far from the map origin the hero wanders.
+typedef struct
+{
+    int x;
+    int y;
+}
+Cell;
+
 typedef struct
 {
     int tile;
-    Point where;
+    // Ray from the caster to the wall, relative to the caster.
+    Point ray;
+    // Where along the wall face the ray struck, from 0 to 1.
+    float u;
 }
 Hit;
 
@@ -24,6 +70,64 @@ typedef struct
 }
 Line;
 
+// A ray part way through walking the grid.
+typedef struct
+{
+    Cell at;
+    Point direction;
+    // Ray parameter at the next vertical and horizontal grid lines, and between grid lines.
+    float tx;
+    float ty;
+    float dx;
+    float dy;
+    // Ray parameter of the last grid line crossed, and whether that line was vertical.
+    float t;
+    int sx;
+    int sy;
+    bool vertical;
+}
+Walker;
+
+// Ways of getting the frame buffer into the streaming texture. Which is fastest depends
+// on the renderer driver, so by default each is timed at startup and the fastest is used.
+typedef enum
+{
+    AUTO,
+    // Lock the texture and copy into it.
+    COPY,
+    // Lock the texture and copy into it with non-temporal stores.
+    STREAM,
+    // Hand the frame buffer to SDL_UpdateTexture.
+    UPDATE,
+    UPLOADS,
+}
+Upload;
+
+static const char* const uploads[UPLOADS] = { "auto", "copy", "stream", "update" };
+
+// Post processing applied to each pixel as the frame buffer is uploaded, so effects cost no
+// extra pass over the frame. Channels are scaled by the vignette and scanline weight, graded
+// through a gamma lookup table with 8 fractional bits, then rounded or ordered dithered to 8 bits.
+typedef struct
+{
+    // Gamma lookup table from a 10 bit weighted channel to an 8.8 fixed point channel.
+    uint16_t lut[1024];
+    // Vignette weights of each screen column and row, 256 being full brightness.
+    // Scanlines are folded into the row weights.
+    uint16_t* across;
+    uint16_t* down;
+    bool dither;
+}
+Post;
+
+// Bytes uploaded and the performance counter ticks spent uploading them.
+typedef struct
+{
+    uint64_t bytes;
+    uint64_t ticks;
+}
+Meter;
+
 typedef struct
 {
     SDL_Window* window;
@@ -31,6 +135,12 @@ typedef struct
     SDL_Texture* texture;
     int xres;
     int yres;
+    // Frame buffer the scene is rendered into, owned by the engine and cache line aligned.
+    uint32_t* pixels;
+    Upload upload;
+    Meter* meter;
+    // Post processing fused into the upload, or NULL.
+    const Post* post;
 }
 Gpu;
 
@@ -49,285 +159,3135 @@ typedef struct
 }
 Wall;
 
+// Texture width and height in texels. Textures are square and a power of two.
+#define TEXSIZE (64)
+
+// Mip levels per texture, down to one texel.
+#define MIPS (7)
+
+// Texels of a texture and all of its mips.
+#define TEXELS (TEXSIZE * TEXSIZE * 4 / 3 + 1)
+
+// Tiles are ascii digits on the map.
+#define TILES (10)
+
+// A texture with its mips stored back to back, largest first.
+// Each mip is stored column-major, so that texels down a wall column are contiguous
+// in memory, the same as the transposed display. A texture that is not resident
+// yet only holds its coarsest mip, so <texels> starts at mip <coarse>.
+typedef struct
+{
+    const uint32_t* texels;
+    int coarse;
+}
+Texture;
+
+// Texture slots per atlas page.
+#define SLOTS (4)
+
+// Most atlas pages ever allocated.
+#define PAGES (64)
+
+// Where a tile is in the atlas.
+typedef enum
+{
+    ABSENT,
+    LOADING,
+    RESIDENT,
+}
+Residency;
+
+// A request for the loader to load <tile> into atlas <slot>.
+typedef struct
+{
+    int tile;
+    int slot;
+}
+Request;
+
+// Wall, floor, and ceiling textures by tile value, packed into atlas pages of SLOTS textures.
+// Textures are loaded on a background thread the first time a tile is seen, and the least
+// recently seen texture is evicted when the atlas would grow past its byte budget.
+// Until a tile is resident it is drawn from its coarsest mip, which is always kept.
+typedef struct
+{
+    uint32_t* pages[PAGES];
+    // Slots the byte budget allows.
+    int slots;
+    // Tile held by each slot, or -1, and the frame it was last seen.
+    int owner[PAGES * SLOTS];
+    int seen[PAGES * SLOTS];
+    // Slot of each tile, and whether the slot is loaded yet.
+    int slot[TILES];
+    Residency residency[TILES];
+    uint32_t placeholder[TILES];
+    // Set by the loader when the slot it was given is filled.
+    SDL_atomic_t loaded[PAGES * SLOTS];
+    // Single producer single consumer request ring, the render loop to the loader.
+    Request requests[TILES];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    SDL_sem* wake;
+    int frame;
+    // Slots backed by allocated pages, and texture lookups that found their tile resident, had to load it, or evicted another.
+    int allocated;
+    int hits;
+    int misses;
+    int evictions;
+}
+Atlas;
+
 typedef struct
 {
     Line fov;
+    Cell cell;
+    // Sub-cell offset within <cell>, kept within [0, 1).
     Point where;
     Point velocity;
     float speed;
     float acceleration;
     float theta;
+    // Simulation ticks, at the fixed simulation rate rather than the frame rate, until the hero can fire again.
+    int reload;
 }
 Hero;
 
+// A run length encoded map plane. Each row is a list of runs of equal tiles.
+// A skip index holds, for every block of columns, the first run touching that block,
+// so any lookup walks at most one block worth of runs.
+typedef struct
+{
+    // Tile value and exclusive end column of each run, rows stored back to back.
+    char* tiles;
+    int* ends;
+    // Index of the first run of each row, with one extra entry for the end of the last row.
+    int* rows;
+    // First run of each block of columns, <blocks> entries per row.
+    int* skip;
+    int blocks;
+    int width;
+    int height;
+}
+Plane;
+
+// Remembers the last run looked up so that lookups stepping along a plane,
+// as floor and ceiling casting do, resolve without touching the skip index.
+typedef struct
+{
+    const Plane* plane;
+    int y;
+    int run;
+}
+Cursor;
+
+typedef struct
+{
+    Plane ceiling;
+    const char** walling;
+    Plane floring;
+}
+Map;
+
+// Bytes every arena allocation is aligned to.
+#define ALIGNMENT (16)
+
+// A block of memory handed out front to back and released all at once.
+typedef struct
+{
+    uint8_t* base;
+    size_t size;
+    size_t used;
+}
+Arena;
+
+// Ascii rows of a level's ceiling, walls, and floor, and the cell the hero starts in.
 typedef struct
 {
     const char** ceiling;
     const char** walling;
     const char** floring;
+    int height;
+    Cell spawn;
+}
+Layout;
+
+// Most levels preloaded at once.
+#define MAPS (4)
+
+// A level preloaded into its own arena: its compressed planes and their skip indices, and its wall rows.
+// Also where the hero starts and which tiles it uses, so their textures can be warmed on switching to it.
+// The wall rows are one mutable block of <bytes> <walls>, so they can be checkpointed in one copy.
+typedef struct
+{
+    Arena arena;
+    Map map;
+    char* walls;
+    size_t bytes;
+    Cell spawn;
+    bool tiles[TILES];
+}
+Level;
+
+// Every preloaded level. Switching levels is picking another index; nothing is built on switching.
+typedef struct
+{
+    Level levels[MAPS];
+    int count;
+}
+Campaign;
+
+// Levels of the depth hierarchy, and the columns each block of a level spans.
+#define SPANS (3)
+
+static const int spans[SPANS] = { 8, 64, 512 };
+
+// Per column wall depth of the last frame, with the nearest and farthest depth of every block
+// of columns at each level. Anything behind the farthest wall of the blocks it covers is hidden,
+// and anything in front of the nearest is fully visible, so most things are resolved with one or
+// two comparisons before any per column work.
+typedef struct
+{
+    float* column;
+    float* near[SPANS];
+    float* far[SPANS];
+    int xres;
+    // Things hidden at each level, and at the column level after that.
+    long culled[SPANS + 1];
+    long tested;
+}
+Depth;
+
+// How much of something is covered by walls.
+typedef enum
+{
+    HIDDEN,
+    PARTIAL,
+    CLEAR,
+}
+Cover;
+
+// How floor and ceiling textures are filtered.
+typedef enum
+{
+    NEAREST,
+    BILINEAR,
+    // Bilinear from the mip matching the footprint of a pixel.
+    MIPMAPPED,
+    FILTERS,
+}
+Filter;
+
+static const char* const filters[FILTERS] = { "nearest", "bilinear", "mip" };
+
+// Cycles spent on each part of drawing a column.
+typedef struct
+{
+    uint32_t cast;
+    uint32_t floring;
+    uint32_t wall;
+    uint32_t ceiling;
+}
+Cost;
+
+// Hits of every column of the last frame, room for each thread to supersample one column <samples> times,
+// the floor and ceiling filters, and, when capturing, the cost of every column of the last frame.
+typedef struct
+{
+    Hit* hits;
+    Cost* costs;
+    uint32_t* scratch;
+    int samples;
+    Filter floring;
+    Filter ceiling;
+}
+Sampler;
+
+// Most threads a pool can have, counting the thread that dispatches.
+#define THREADS (64)
+
+// Work split into <parts> parts, of which one thread does <part>.
+typedef void (*Job)(void* data, int part, int parts);
+
+struct Pool;
+
+// Where the main thread and pool workers run: thread i is pinned to <cores>[i % <count>], or to core i
+// when <count> is 0 and <pin> is set. A nonzero <priority> runs them SCHED_FIFO at that priority.
+typedef struct
+{
+    bool pin;
+    int cores[THREADS];
+    int count;
+    int priority;
+}
+Affinity;
+
+// A pool thread, the core it is pinned to, or -1, and its SCHED_FIFO priority, or 0.
+typedef struct
+{
+    struct Pool* pool;
+    int index;
+    int cpu;
+    int priority;
+}
+Worker;
+
+// Thread counts a pool tries while tuning, and frames spent on each; the first few warm up.
+#define TRIALS (8)
+#define WARMUP (4)
+
+// A persistent pool of threads for splitting per frame work. Workers spin on the frame word
+// for a short while after each job, so back to back dispatches start within microseconds, and
+// then park on a semaphore, so an idle pool costs nothing. The dispatching thread does a part too.
+// The frame word holds a dispatch generation in its upper bits and the parts the dispatch is split
+// into in its low byte, so workers beyond the active count skip a dispatch without racing it.
+typedef struct Pool
+{
+    SDL_atomic_t frame;
+    SDL_atomic_t remaining;
+    SDL_atomic_t parked[THREADS];
+    SDL_sem* wake[THREADS];
+    Worker workers[THREADS];
+    Job job;
+    void* data;
+    // Threads started, counting the dispatching thread, and how many of them work.
+    int threads;
+    int active;
+    // Performance counter ticks spent in dispatches this frame and last frame.
+    uint64_t busy;
+    uint64_t last;
+    // Tuning: the resolution tuned for, the trial running, frames into it, and the counts tried
+    // with the fastest frame of each. The trial is -1 when not tuning.
+    bool tune;
+    int xres;
+    int yres;
+    int trial;
+    int step;
+    int counts[TRIALS];
+    uint64_t fastest[TRIALS];
+    // Performance counter ticks to spin before parking.
+    uint64_t spin;
+    // Performance counter at the last dispatch, and how long after it each worker started.
+    uint64_t dispatched;
+    uint64_t started[THREADS];
+    // Worst dispatch to start latency and barrier wait of the current frame, and of all frames.
+    uint64_t latency;
+    uint64_t waiting;
+    uint64_t latencies;
+    uint64_t waitings;
+    uint64_t worst;
+    int frames;
+}
+Pool;
+
+// Frame times kept for the jitter report.
+#define INTERVALS (4096)
+
+// The times between the last <INTERVALS> frames, in milliseconds, as a ring.
+typedef struct
+{
+    float ms[INTERVALS];
+    int count;
+    uint64_t last;
+}
+Jitter;
+
+// Paces frames to a target rate: sleeps until shortly before each deadline, then spins the rest.
+// A <period> of 0 is uncapped. Times are monotonic nanoseconds. The frame interval is a running
+// average of the time between presents. The <refresh> interval of the display, in milliseconds,
+// is taken from its mode when presents wait for vertical sync, and is 0 otherwise.
+typedef struct
+{
+    float refresh;
+    uint64_t period;
+    uint64_t deadline;
+    uint64_t spin;
+    uint64_t presented;
+    double interval;
+    // Absolute lateness or earliness of each wake against its deadline, and frames paced.
+    uint64_t error;
+    uint64_t worst;
+    int frames;
+}
+Pacer;
+
+// Input events a queue holds before dropping.
+#define INPUTS (256)
+
+// A key going down or up, or the window closing, stamped with the monotonic nanosecond it was polled.
+typedef struct
+{
+    uint64_t time;
+    SDL_Scancode key;
+    bool down;
+    bool quit;
+}
+Input;
+
+// Single producer single consumer input ring, the event poll to the simulation, and the key state
+// the simulation builds from it. A key counts as held for a tick if it was down at any point
+// in the tick, so taps shorter than a tick are not lost.
+typedef struct
+{
+    Input inputs[INPUTS];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    // Inputs dropped by the producer on a full ring.
+    int dropped;
+    // Consumer side: keys down, keys seen this tick, and whether to quit.
+    uint8_t held[SDL_NUM_SCANCODES];
+    uint8_t key[SDL_NUM_SCANCODES];
+    bool quit;
+    // Total age of inputs when consumed, in nanoseconds, and inputs consumed.
+    uint64_t age;
+    int events;
+}
+Queue;
+
+// Pellets per shot, and shots a snapshot remembers.
+#define PELLETS (8)
+#define SHOTS (4)
+
+// A shot fired from a <cell> and sub-cell point <where>: where each pellet hit, relative to <where>.
+typedef struct
+{
+    Cell cell;
+    Point where;
+    Point impacts[PELLETS];
+}
+Shot;
+
+// Simulation state the renderer needs: the hero, the last shots fired, shots fired in total,
+// ticks simulated, and whether the simulation has quit.
+typedef struct
+{
+    Hero hero;
+    Shot shots[SHOTS];
+    int fired;
+    int tick;
+    bool quit;
+    // Profiler, cost capture, checkpoint save, and checkpoint restore hotkey presses.
+    int toggles;
+    int captures;
+    int saves;
+    int restores;
+    // When the last save and the last restore were pressed, counting both kinds of press,
+    // and which save, counting saves, the last restore rolled back to.
+    int saved;
+    int restored;
+    int rewound;
+    // Index of the level being played.
+    int level;
+}
+Snapshot;
+
+// Set in a handoff's latest index while the snapshot it names has not yet been observed.
+#define FRESH (4)
+
+// Triple buffered, lock-free snapshot handoff from the simulation to the renderer. The simulation
+// writes its <back> snapshot and swaps it with <latest>; the renderer swaps its <front> snapshot
+// with <latest> when it is fresh. Neither side waits on the other.
+typedef struct
+{
+    Snapshot snapshots[3];
+    SDL_atomic_t latest;
+    int back;
+    int front;
+}
+Handoff;
+
+// Header of each section of a checkpoint: what the section holds, its layout version, and its bytes, header included.
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t bytes;
+}
+Section;
+
+// Bump when a structure saved in a checkpoint changes to invalidate all saved sections.
+#define SAVEVERSION (2)
+
+// Particles saved with a checkpoint, besides their arrays: the save of the simulation they go with,
+// the simulation tick they were saved at, and the rest of their plain fields.
+typedef struct
+{
+    int save;
+    int tick;
+    Cell origin;
+    int count;
+    uint32_t seed;
+}
+Swarm;
+
+// A checkpoint: a tape of plain bytes, written front to back with one copy per field or array,
+// and read back the same way. Also how long saves and restores took, in nanoseconds, and how many were made.
+typedef struct
+{
+    Arena tape;
+    uint64_t saving;
+    uint64_t restoring;
+    int saves;
+    int restores;
+}
+Checkpoint;
+
+// What the simulation thread runs on: the state it starts from, the levels it moves through,
+// the input it consumes, the handoff it publishes to, its checkpoint, and its tick rate.
+typedef struct
+{
+    Snapshot first;
+    Campaign* campaign;
+    Queue* inputs;
+    Handoff* handoff;
+    Checkpoint* checkpoint;
+    float rate;
+}
+Simulation;
+
+// Frame time histogram bucket bounds, in milliseconds, for the stats endpoint.
+#define BUCKETS (8)
+
+static const int buckets[BUCKETS] = { 4, 8, 12, 17, 20, 33, 50, 100 };
+
+// Render stages timed for the stats endpoint.
+typedef enum
+{
+    CASTING, DRAWING, SPLATTING, UPLOADING, PRESENTING, STAGES
+}
+Stage;
+
+static const char* const stages[STAGES] = { "cast", "draw", "splat", "upload", "present" };
+
+// Stacks the profiler keeps, newest overwriting oldest, and frames kept per stack.
+#define STACKS (16384)
+#define DEPTH (32)
+
+// A call stack captured by the profiler, innermost frame first.
+typedef struct
+{
+    void* frames[DEPTH];
+    int depth;
+}
+Stack;
+
+// A sampling profiler: while running, a SIGPROF every millisecond of process CPU time captures
+// the stack of whichever thread was running into a ring. It is toggled by hotkey presses and
+// SIGUSR1 signals, and on stopping writes the ring as folded stacks to <prefix>-<n>.folded.
+typedef struct
+{
+    Stack* stacks;
+    SDL_atomic_t taken;
+    SDL_atomic_t signals;
+    int toggles;
+    bool running;
+    int dumps;
+    const char* prefix;
+}
+Profiler;
+
+// Subsystems memory is accounted to.
+typedef enum
+{
+    LEVELS, DERIVED, TEXTURES, FRAMEBUFFERS, PARTICLES, CHECKPOINTS, SUBSYSTEMS
+}
+Subsystem;
+
+static const char* const subsystems[SUBSYSTEMS] = { "levels", "derived", "textures", "framebuffers", "particles", "checkpoints" };
+
+// Counters and gauges written by the render loop and read, without locks but one, by the stats endpoint.
+typedef struct
+{
+    // Frames, frames by time bucket, and total frame time in microseconds. SDL has no 64 bit atomics,
+    // so the total, which would wrap a 32 bit counter within an hour, is kept under a spin lock.
+    SDL_atomic_t frames;
+    SDL_atomic_t histogram[BUCKETS + 1];
+    SDL_SpinLock lock;
+    uint64_t elapsed;
+    // Rays cast over the last second, and microseconds spent in each stage of the last frame.
+    SDL_atomic_t rays;
+    SDL_atomic_t micros[STAGES];
+    // Working render threads, and per mille of the last frame they spent on casting and drawing.
+    SDL_atomic_t threads;
+    SDL_atomic_t utilization;
+    // Bytes allocated by each subsystem, and estimated bytes read and written by each stage of the last frame.
+    SDL_atomic_t memory[SUBSYSTEMS];
+    SDL_atomic_t reads[STAGES];
+    SDL_atomic_t writes[STAGES];
+    // Texture cache lookups.
+    SDL_atomic_t hits;
+    SDL_atomic_t misses;
+    SDL_atomic_t evictions;
+    // Render loop only: rays cast since, and performance counter at, the start of the current second,
+    // and estimated bytes read and written by each stage over all frames accounted.
+    int counted;
+    uint64_t second;
+    uint64_t read[STAGES];
+    uint64_t written[STAGES];
+    int accounted;
+    // Listening socket.
+    int listener;
+}
+Stats;
+
+// A frame being rendered, shared by the threads of a pool. Each thread marks the tiles it draws
+// in its own row of <seen>.
+typedef struct
+{
+    Hero hero;
+    Map map;
+    const Atlas* atlas;
+    Depth* depth;
+    const Sampler* sampler;
+    Line camera;
+    Display display;
+    int xres;
+    int yres;
+    bool seen[THREADS][TILES];
+    int rays[THREADS];
+}
+Scene;
+
+// Sparks, smoke, and debris. Stored as a structure of arrays so that updating every
+// particle is a handful of straight loops the compiler can vectorize. Positions are relative
+// to the <origin> cell, and heights run from 0 at the floor to 1 at the ceiling.
+typedef struct
+{
+    float* x;
+    float* y;
+    float* z;
+    float* vx;
+    float* vy;
+    float* vz;
+    float* life;
+    uint32_t* color;
+    Cell origin;
+    int count;
+    int max;
+    uint32_t seed;
+    // Benchmark timings, in performance counter ticks, and frames timed.
+    uint64_t updating;
+    uint64_t splatting;
+    uint64_t particles;
+    int frames;
+}
+Particles;
+
+// Command line options.
+typedef struct
+{
+    // Bytes of textures the atlas may keep resident.
+    int budget;
+    // Particles to keep alive for the particle benchmark, zero when not benchmarking.
+    int particles;
+    // How the frame buffer is uploaded.
+    Upload upload;
+    // Rays cast per column on wall edges.
+    int samples;
+    // Floor and ceiling texture filters, and whether to benchmark them all instead of playing.
+    Filter floring;
+    Filter ceiling;
+    bool compare;
+    // Post processing.
+    float gamma;
+    bool scanlines;
+    bool vignette;
+    bool dither;
+    // Render threads, counting the main thread, or 0 to tune, and where they run.
+    int threads;
+    Affinity affinity;
+    // Frames per second to pace to, or 0 for uncapped, and whether presents also wait for vertical sync.
+    float fps;
+    bool vsync;
+    // Unix domain socket path to serve stats on, or NULL.
+    const char* stats;
+    // Start of profile file names, and of column cost file names, or NULL to not capture costs.
+    const char* profile;
+    const char* costs;
+}
+Options;
+
+// Rotates the player by some radian value.
+static Point turn(const Point a, const float t)
+{
+    const Point b = { a.x * cosf(t) - a.y * sinf(t), a.x * sinf(t) + a.y * cosf(t) };
+    return b;
+}
+
+// Rotates a point 90 degrees.
+static Point rag(const Point a)
+{
+    const Point b = { -a.y, a.x };
+    return b;
+}
+
+// Subtracts two points.
+static Point sub(const Point a, const Point b)
+{
+    const Point c = { a.x - b.x, a.y - b.y };
+    return c;
+}
+
+// Adds two points.
+static Point add(const Point a, const Point b)
+{
+    const Point c = { a.x + b.x, a.y + b.y };
+    return c;
+}
+
+// Multiplies a point by a scalar value.
+static Point mul(const Point a, const float n)
+{
+    const Point b = { a.x * n, a.y * n };
+    return b;
+}
+
+// Returns the magnitude of a point.
+static float mag(const Point a)
+{
+    return sqrtf(a.x * a.x + a.y * a.y);
+}
+
+// Returns the unit vector of a point.
+static Point unit(const Point a)
+{
+    return mul(a, 1.0f / mag(a));
+}
+
+// Fast floor (math.h is too slow).
+static int fl(const float x)
+{
+    return (int) x - (x < (int) x);
+}
+
+// Floating point decimal.
+static float dec(const float x)
+{
+    return x - fl(x);
+}
+
+// Returns a decimal value of the ascii tile value on the map at <a> relative to the <origin> cell.
+static int tile(const Cell origin, const Point a, const char** const tiles)
+{
+    const int x = origin.x + fl(a.x);
+    const int y = origin.y + fl(a.y);
+    return tiles[y][x] - '0';
+}
+
+// Columns per skip index block of a compressed plane.
+#define BLOCK (32)
+
+// Reserves an arena of <size> bytes.
+static Arena reserve(const size_t size)
+{
+    Arena arena = { malloc(size), size, 0 };
+    if(arena.base == NULL)
+    {
+        puts("out of memory reserving arena");
+        exit(1);
+    }
+    return arena;
+}
+
+// Hands out <bytes> from an <arena>.
+static void* carve(Arena* const arena, const size_t bytes)
+{
+    const size_t at = (arena->used + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    if(at + bytes > arena->size)
+    {
+        puts("arena exhausted");
+        exit(1);
+    }
+    arena->used = at + bytes;
+    return arena->base + at;
+}
+
+// Releases everything handed out from an <arena> at once.
+static void release(Arena* const arena)
+{
+    free(arena->base);
+    const Arena empty = { NULL, 0, 0 };
+    *arena = empty;
+}
+
+// Returns <bytes> rounded up to a whole number of arena alignments.
+static size_t padded(const size_t bytes)
+{
+    return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Returns the number of runs in <height> ascii rows of <tiles>, the first pass of compressing them.
+static int runlength(const char** const tiles, const int height)
+{
+    const int width = strlen(tiles[0]);
+    int runs = 0;
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+            runs += x == 0 || tiles[y][x] != tiles[y][x - 1];
+    return runs;
+}
+
+// Returns the arena bytes compressing <height> ascii rows of <tiles> carves.
+static size_t packed(const char** const tiles, const int height)
+{
+    const size_t runs = runlength(tiles, height);
+    const size_t blocks = (strlen(tiles[0]) + BLOCK - 1) / BLOCK;
+    return padded(runs * sizeof(char)) + padded(runs * sizeof(int))
+        + padded((height + 1) * sizeof(int)) + padded(height * blocks * sizeof(int));
+}
+
+// Compresses <height> ascii rows of <tiles> into a run length encoded plane, carved from an <arena>.
+static Plane compress(const char** const tiles, const int height, Arena* const arena)
+{
+    const int width = strlen(tiles[0]);
+    const int runs = runlength(tiles, height);
+    Plane plane;
+    plane.width = width;
+    plane.height = height;
+    plane.blocks = (width + BLOCK - 1) / BLOCK;
+    plane.tiles = carve(arena, runs * sizeof(*plane.tiles));
+    plane.ends = carve(arena, runs * sizeof(*plane.ends));
+    plane.rows = carve(arena, (height + 1) * sizeof(*plane.rows));
+    plane.skip = carve(arena, height * plane.blocks * sizeof(*plane.skip));
+    int run = 0;
+    for(int y = 0; y < height; y++)
+    {
+        plane.rows[y] = run;
+        for(int x = 0; x < width; x++)
+        {
+            if(x % BLOCK == 0)
+                plane.skip[y * plane.blocks + x / BLOCK] = x == 0 || tiles[y][x] != tiles[y][x - 1] ? run : run - 1;
+            if(x == 0 || tiles[y][x] != tiles[y][x - 1])
+                plane.tiles[run++] = tiles[y][x] - '0';
+            plane.ends[run - 1] = x + 1;
+        }
+    }
+    plane.rows[height] = run;
+    return plane;
+}
+
+// Starts a cursor on a compressed <plane>.
+static Cursor cursor(const Plane* const plane)
+{
+    const Cursor c = { plane, -1, 0 };
+    return c;
+}
+
+// Returns the tile at <a> relative to the <origin> cell, stepping the <cursor> to it.
+// The run is found by walking from the last run when on the same row, else through the skip index.
+static int step(Cursor* const c, const Cell origin, const Point a)
+{
+    const Plane* const plane = c->plane;
+    const int x = origin.x + fl(a.x);
+    const int y = origin.y + fl(a.y);
+    if(y != c->y)
+    {
+        c->y = y;
+        c->run = plane->skip[y * plane->blocks + x / BLOCK];
+    }
+    else
+        while(c->run > plane->rows[y] && plane->ends[c->run - 1] > x)
+            c->run--;
+    while(plane->ends[c->run] <= x)
+        c->run++;
+    return plane->tiles[c->run];
+}
+
+// Distance along <d> between two grid lines. Axis aligned rays never cross such a line.
+static float delta(const float d)
+{
+    return d == 0.0f ? 1e30f : fabsf(1.0f / d);
+}
+
+// Starts walking the grid from sub-cell offset <where> within <cell> along <direction>.
+static Walker aim(const Cell cell, const Point where, const Point direction)
+{
+    const float dx = delta(direction.x);
+    const float dy = delta(direction.y);
+    const Walker walker = {
+        cell,
+        direction,
+        // Ray parameter at the next vertical and horizontal grid lines.
+        (direction.x > 0.0f ? 1.0f - where.x : where.x) * dx,
+        (direction.y > 0.0f ? 1.0f - where.y : where.y) * dy,
+        dx,
+        dy,
+        0.0f,
+        direction.x > 0.0f ? 1 : -1,
+        direction.y > 0.0f ? 1 : -1,
+        false,
+    };
+    return walker;
+}
+
+// Steps a <walker> into the next grid cell it crosses, returning the <walling> tile there.
+static int advance(Walker* const w, const char** const walling)
+{
+    if(w->tx < w->ty)
+    {
+        w->t = w->tx;
+        w->tx += w->dx;
+        w->at.x += w->sx;
+        w->vertical = true;
+    }
+    else
+    {
+        w->t = w->ty;
+        w->ty += w->dy;
+        w->at.y += w->sy;
+        w->vertical = false;
+    }
+    return walling[w->at.y][w->at.x] - '0';
+}
+
+// Returns the hit of a <walker> that started at <where> and stopped on <tile>.
+static Hit strike(const Walker w, const Point where, const int tile)
+{
+    const Point ray = mul(w.direction, w.t);
+    const Hit hit = { tile, ray, w.vertical ? dec(where.y + ray.y) : dec(where.x + ray.x) };
+    return hit;
+}
+
+// Casts a ray from sub-cell offset <where> within <cell> along <direction> until a <walling> tile is hit.
+// The grid is walked one integer cell at a time, so there is no floating point drift or epsilon
+// nudging at cell boundaries regardless of how large the cell coordinates become.
+static Hit cast(const Cell cell, const Point where, const Point direction, const char** const walling)
+{
+    Walker walker = aim(cell, where, direction);
+    for(;;)
+    {
+        const int tile = advance(&walker, walling);
+        if(tile)
+            return strike(walker, where, tile);
+    }
+}
+
+// Rays walked together by hitscan().
+#define LANES (8)
+
+// Casts <count> rays from sub-cell offset <where> within <cell> along <directions>, writing the
+// nearest <walling> hit of each to <hits>. Rays are walked in lanes, one cell per lane per round,
+// so the independent walks and their map reads overlap; a lane stops as soon as its ray hits.
+static void hitscan(const Cell cell, const Point where, const Point* const directions, const int count,
+    const char** const walling, Hit* const hits)
+{
+    for(int base = 0; base < count; base += LANES)
+    {
+        const int lanes = count - base < LANES ? count - base : LANES;
+        Walker walkers[LANES];
+        bool done[LANES] = { false };
+        for(int lane = 0; lane < lanes; lane++)
+            walkers[lane] = aim(cell, where, directions[base + lane]);
+        for(int live = lanes; live > 0;)
+            for(int lane = 0; lane < lanes; lane++)
+            {
+                if(done[lane])
+                    continue;
+                const int tile = advance(&walkers[lane], walling);
+                if(tile)
+                {
+                    hits[base + lane] = strike(walkers[lane], where, tile);
+                    done[lane] = true;
+                    live--;
+                }
+            }
+    }
+}
+
+// Party casting. Returns a percentage of <y> related to <yres> for ceiling and
+// floor casting when lerping the floor or ceiling.
+static float pcast(const float size, const int yres, const int y)
+{
+    return size / (2 * (y + 1) - yres);
+}
+
+// Rotates a line by some radian amount.
+static Line rotate(const Line l, const float t)
+{
+    const Line line = { turn(l.a, t), turn(l.b, t) };
+    return line;
+}
+
+// Linear interpolation.
+static Point lerp(const Line l, const float n)
+{
+    return add(l.a, mul(sub(l.b, l.a), n));
+}
+
+// Ordered dither thresholds.
+static const uint8_t bayer[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+// Post processes <count> pixels of screen column <x>, starting at row <row>, from <src> into <dst>.
+static void grade(const Post* const post, uint32_t* const restrict dst, const uint32_t* const restrict src, const int count, const int x, const int row)
+{
+    const int across = post->across[x];
+    int dither[4];
+    for(int i = 0; i < 4; i++)
+        dither[i] = post->dither ? bayer[x % 4][i] * 16 + 8 : 128;
+    for(int i = 0; i < count; i++)
+    {
+        const int y = row + i;
+        const uint32_t pixel = src[i];
+        const int weight = across * post->down[y] >> 8;
+        const int d = dither[y % 4];
+        // The table tops out at 255.0 and the dither below 1.0, so channels never overflow.
+        const uint32_t r = (post->lut[(pixel >> 16 & 0xFF) * weight >> 6] + d) >> 8;
+        const uint32_t g = (post->lut[(pixel >> 8 & 0xFF) * weight >> 6] + d) >> 8;
+        const uint32_t b = (post->lut[(pixel >> 0 & 0xFF) * weight >> 6] + d) >> 8;
+        dst[i] = (pixel & 0xFF000000) | r << 16 | g << 8 | b;
+    }
+}
+
+// Copies the frame buffer into the locked streaming texture, row by row in case the pitches differ.
+static void copy(const Gpu gpu)
+{
+    void* screen;
+    int pitch;
+    if(SDL_LockTexture(gpu.texture, NULL, &screen, &pitch) != 0)
+        return;
+    const size_t row = gpu.yres * sizeof(*gpu.pixels);
+    for(int x = 0; x < gpu.xres; x++)
+    {
+        uint32_t* const dst = (uint32_t*) ((uint8_t*) screen + x * pitch);
+        const uint32_t* const src = gpu.pixels + x * gpu.yres;
+        if(gpu.post)
+            grade(gpu.post, dst, src, gpu.yres, x, 0);
+        else
+            memcpy(dst, src, row);
+    }
+    SDL_UnlockTexture(gpu.texture);
+}
+
+// Copies <count> pixels from <src> to <dst> with non-temporal stores. Texture memory is often
+// write combined or uncached, so streaming whole lines past the cache in one sequential pass
+// beats ordinary stores, and does not evict the frame buffer or textures from the cache.
+static void stream(uint32_t* const dst, const uint32_t* const src, const int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    // Stores up to the first 16 byte boundary are ordinary.
+    for(; i < count && (uintptr_t) (dst + i) % 16 != 0; i++)
+        dst[i] = src[i];
+    for(; i + 4 <= count; i += 4)
+        _mm_stream_si128((__m128i*) (dst + i), _mm_loadu_si128((const __m128i*) (src + i)));
+#endif
+    for(; i < count; i++)
+        dst[i] = src[i];
+}
+
+// Pixels post processed at a time before being streamed out, small enough to stay in L1.
+#define CHUNK (256)
+
+// Post processes <count> pixels of screen column <x> from <src> and streams them to <dst>,
+// a chunk at a time through a cache resident buffer.
+static void develop(const Post* const post, uint32_t* const dst, const uint32_t* const src, const int count, const int x)
+{
+    uint32_t chunk[CHUNK];
+    for(int i = 0; i < count; i += CHUNK)
+    {
+        const int n = count - i < CHUNK ? count - i : CHUNK;
+        grade(post, chunk, src + i, n, x, i);
+        stream(dst + i, chunk, n);
+    }
+}
+
+// Streams the frame buffer into the locked streaming texture.
+static void flush(const Gpu gpu)
+{
+    void* screen;
+    int pitch;
+    if(SDL_LockTexture(gpu.texture, NULL, &screen, &pitch) != 0)
+        return;
+    for(int x = 0; x < gpu.xres; x++)
+    {
+        uint32_t* const dst = (uint32_t*) ((uint8_t*) screen + x * pitch);
+        const uint32_t* const src = gpu.pixels + x * gpu.yres;
+        if(gpu.post)
+            develop(gpu.post, dst, src, gpu.yres, x);
+        else
+            stream(dst, src, gpu.yres);
+    }
+#ifdef __SSE2__
+    // Non-temporal stores must be fenced before the driver reads the texture.
+    _mm_sfence();
+#endif
+    SDL_UnlockTexture(gpu.texture);
+}
+
+// Uploads the frame buffer to the streaming texture with the gpu's upload strategy.
+static void upload(const Gpu gpu)
+{
+    const uint64_t t0 = SDL_GetPerformanceCounter();
+    switch(gpu.upload)
+    {
+    default:
+    case COPY:
+        copy(gpu);
+        break;
+    case STREAM:
+        flush(gpu);
+        break;
+    case UPDATE:
+        SDL_UpdateTexture(gpu.texture, NULL, gpu.pixels, gpu.yres * sizeof(*gpu.pixels));
+        break;
+    }
+    gpu.meter->ticks += SDL_GetPerformanceCounter() - t0;
+    gpu.meter->bytes += (uint64_t) gpu.xres * gpu.yres * sizeof(*gpu.pixels);
+}
+
+// Prints the upload bandwidth of the frames uploaded so far.
+static void bandwidth(const Gpu gpu)
+{
+    if(gpu.meter->ticks == 0)
+        return;
+    const double seconds = (double) gpu.meter->ticks / SDL_GetPerformanceFrequency();
+    printf("upload: %s %.2f GB/s\n", uploads[gpu.upload], gpu.meter->bytes / seconds / 1e9);
+}
+
+// Times a few uploads with each strategy and returns the fastest.
+static Upload fastest(Gpu gpu)
+{
+    const int trials = 16;
+    Upload best = COPY;
+    double least = 0.0;
+    for(Upload u = COPY; u < UPLOADS; u++)
+    {
+        // Post processing is fused into the copy, which SDL_UpdateTexture does not allow.
+        if(gpu.post && u == UPDATE)
+            continue;
+        gpu.upload = u;
+        // The first upload is not timed so that driver setup is not counted.
+        upload(gpu);
+        const uint64_t t0 = SDL_GetPerformanceCounter();
+        for(int i = 0; i < trials; i++)
+            upload(gpu);
+        const double ms = 1e3 * (SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency() / trials;
+        printf("upload: %s %.3f ms\n", uploads[u], ms);
+        // Trial uploads do not count towards the session bandwidth.
+        const Meter zero = { 0, 0 };
+        *gpu.meter = zero;
+        if(u == COPY || ms < least)
+        {
+            best = u;
+            least = ms;
+        }
+    }
+    printf("upload: using %s\n", uploads[best]);
+    return best;
+}
+
+// Setups the software gpu.
+static Gpu setup(const int xres, const int yres, const bool vsync, const Upload upload, const Post* const post)
+{
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    {
+        puts(SDL_GetError());
+        exit(1);
+    }
+    SDL_Window* const window = SDL_CreateWindow(
+        "littlewolf",
+        SDL_WINDOWPOS_UNDEFINED,
+        SDL_WINDOWPOS_UNDEFINED,
+        xres, yres,
+        SDL_WINDOW_SHOWN);
+    SDL_Renderer* const renderer = SDL_CreateRenderer(
+        window,
+        -1,
+        SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0x0));
+    // Notice the flip between xres and yres.
+    // The texture is 90 degrees flipped on its side for fast cache access.
+    SDL_Texture* const texture = SDL_CreateTexture(
+        renderer,
+        SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING,
+        yres, xres);
+    if(window == NULL || renderer == NULL || texture == NULL)
+    {
+        puts(SDL_GetError());
+        exit(1);
+    }
+    // The frame buffer is aligned to a cache line by hand, as C99 has no aligned allocation.
+    const size_t align = 64;
+    uint8_t* const block = calloc(xres * yres * sizeof(uint32_t) + align, 1);
+    if(block == NULL)
+    {
+        puts("out of memory creating frame buffer");
+        exit(1);
+    }
+    uint32_t* const pixels = (uint32_t*) (block + align - (uintptr_t) block % align);
+    Meter* const meter = calloc(1, sizeof(*meter));
+    if(meter == NULL)
+    {
+        puts("out of memory creating frame buffer");
+        exit(1);
+    }
+    Gpu gpu = { window, renderer, texture, xres, yres, pixels, upload, meter, post };
+    if(gpu.post && gpu.upload == UPDATE)
+    {
+        puts("upload: post processing needs a locked texture, using stream");
+        gpu.upload = STREAM;
+    }
+    if(gpu.upload == AUTO)
+        gpu.upload = fastest(gpu);
+    return gpu;
+}
+
+// Returns the vignette weight, 256 being full brightness, at <n> from -1 to 1 across the screen.
+static uint16_t vignette(const float n)
+{
+    return 256.0f * (1.0f - 0.35f * n * n);
+}
+
+// Builds the post processing for an <xres> by <yres> screen from the <options>,
+// returning NULL when no effect is enabled.
+static Post* process(const Options options, const int xres, const int yres)
+{
+    if(options.gamma == 1.0f && !options.scanlines && !options.vignette && !options.dither)
+        return NULL;
+    Post* const post = calloc(1, sizeof(*post));
+    if(post == NULL
+    || (post->across = malloc(xres * sizeof(*post->across))) == NULL
+    || (post->down = malloc(yres * sizeof(*post->down))) == NULL)
+    {
+        puts("out of memory creating post processing");
+        exit(1);
+    }
+    for(int i = 0; i < 1024; i++)
+        post->lut[i] = 255.0f * 256.0f * powf(i / 1020.0f > 1.0f ? 1.0f : i / 1020.0f, 1.0f / options.gamma);
+    for(int x = 0; x < xres; x++)
+        post->across[x] = options.vignette ? vignette(2.0f * x / xres - 1.0f) : 256;
+    for(int y = 0; y < yres; y++)
+    {
+        const int weight = options.vignette ? vignette(2.0f * y / yres - 1.0f) : 256;
+        post->down[y] = options.scanlines && y % 2 ? weight * 3 / 4 : weight;
+    }
+    post->dither = options.dither;
+    return post;
+}
+
+// Presents the software gpu to the window.
+// Calls the real GPU to rotate texture back 90 degrees before presenting.
+static void present(const Gpu gpu)
+{
+    const SDL_Rect dst = {
+        (gpu.xres - gpu.yres) / 2,
+        (gpu.yres - gpu.xres) / 2,
+        gpu.yres, gpu.xres,
+    };
+    SDL_RenderCopyEx(gpu.renderer, gpu.texture, NULL, &dst, -90, NULL, SDL_FLIP_NONE);
+    SDL_RenderPresent(gpu.renderer);
+}
+
+// Returns the refresh interval of the display showing a <gpu>'s window in milliseconds, or 0 if unknown.
+static float refresh(const Gpu gpu)
+{
+    SDL_DisplayMode mode;
+    const int display = SDL_GetWindowDisplayIndex(gpu.window);
+    if(display < 0 || SDL_GetCurrentDisplayMode(display, &mode) != 0 || mode.refresh_rate <= 0)
+        return 0.0f;
+    return 1000.0f / mode.refresh_rate;
+}
+
+// Locks the gpu for drawing, returning its frame buffer.
+static Display lock(const Gpu gpu)
+{
+    const Display display = { gpu.pixels, gpu.yres };
+    return display;
+}
+
+// Places a pixels in the gpu frame buffer.
+static void put(const Display display, const int x, const int y, const uint32_t pixel)
+{
+    display.pixels[y + x * display.width] = pixel;
+}
+
+// Unlocks the gpu, uploading its frame buffer to video memory ready for presentation.
+static void unlock(const Gpu gpu)
+{
+    upload(gpu);
+}
+
+// Spins the hero when keys h,l are held down.
+static Hero spin(Hero hero, const uint8_t* key)
+{
+    if(key[SDL_SCANCODE_H]) hero.theta -= 0.1f;
+    if(key[SDL_SCANCODE_L]) hero.theta += 0.1f;
+    return hero;
+}
+
+// Moves whole cells out of the hero's sub-cell offset and into the hero's cell.
+static Hero rebase(Hero hero)
+{
+    const Cell step = { fl(hero.where.x), fl(hero.where.y) };
+    const Point shift = { step.x, step.y };
+    hero.cell.x += step.x;
+    hero.cell.y += step.y;
+    hero.where = sub(hero.where, shift);
+    return hero;
+}
+
+// Moves the hero when w,a,s,d are held down. Handles collision detection for the walls.
+static Hero move(Hero hero, const char** const walling, const uint8_t* key)
+{
+    const Point last = hero.where, zero = { 0.0f, 0.0f };
+    // Accelerates with key held down.
+    if(key[SDL_SCANCODE_W] || key[SDL_SCANCODE_S] || key[SDL_SCANCODE_D] || key[SDL_SCANCODE_A])
+    {
+        const Point reference = { 1.0f, 0.0f };
+        const Point direction = turn(reference, hero.theta);
+        const Point acceleration = mul(direction, hero.acceleration);
+        if(key[SDL_SCANCODE_W]) hero.velocity = add(hero.velocity, acceleration);
+        if(key[SDL_SCANCODE_S]) hero.velocity = sub(hero.velocity, acceleration);
+        if(key[SDL_SCANCODE_D]) hero.velocity = add(hero.velocity, rag(acceleration));
+        if(key[SDL_SCANCODE_A]) hero.velocity = sub(hero.velocity, rag(acceleration));
+    }
+    // Otherwise, decelerates (exponential decay).
+    else hero.velocity = mul(hero.velocity, 1.0f - hero.acceleration / hero.speed);
+    // Caps velocity if top speed is exceeded.
+    if(mag(hero.velocity) > hero.speed) hero.velocity = mul(unit(hero.velocity), hero.speed);
+    // Moves.
+    hero.where = add(hero.where, hero.velocity);
+    // Sets velocity to zero if there is a collision and puts hero back in bounds.
+    if(tile(hero.cell, hero.where, walling))
+    {
+        hero.velocity = zero;
+        hero.where = last;
+    }
+    return rebase(hero);
+}
+
+// Drops the hero at rest in the middle of the <spawn> cell, still facing the same way.
+static Hero arrive(Hero hero, const Cell spawn)
+{
+    const Point middle = { 0.5f, 0.5f }, zero = { 0.0f, 0.0f };
+    hero.cell = spawn;
+    hero.where = middle;
+    hero.velocity = zero;
+    return hero;
+}
+
+// Returns a color value (RGB) from a decimal tile value.
+static uint32_t color(const int tile)
+{
+    switch(tile)
+    {
+    default:
+    case 1: return 0x00AA0000; // Red.
+    case 2: return 0x0000AA00; // Green.
+    case 3: return 0x000000AA; // Blue.
+    }
+}
+
+// Returns the width and height of mip <level>.
+static int side(const int level)
+{
+    return TEXSIZE >> level;
+}
+
+// Returns a pointer to the first texel of mip <level> of a <texture>.
+static const uint32_t* mip(const Texture texture, const int level)
+{
+    int offset = 0;
+    for(int i = texture.coarse; i < level; i++)
+        offset += side(i) * side(i);
+    return texture.texels + offset;
+}
+
+// Returns the texel at <u>, <v> (both from 0 to 1) of mip <level> of a <texture>,
+// or of its coarsest mip if it does not hold <level>.
+static uint32_t sample(const Texture texture, const int level, const float u, const float v)
+{
+    const int l = level < texture.coarse ? texture.coarse : level;
+    const int size = side(l);
+    const int x = u * size;
+    const int y = v * size;
+    return mip(texture, l)[(x & (size - 1)) * size + (y & (size - 1))];
+}
+
+// Blends ARGB texels <a> and <b> by 8 bit fixed point weight <w> out of 256, two channels
+// per multiply: red and blue share one 32 bit lane, alpha and green the other.
+static uint32_t blend(const uint32_t a, const uint32_t b, const uint32_t w)
+{
+    const uint32_t rb = ((a & 0x00FF00FF) * (256 - w) + (b & 0x00FF00FF) * w) >> 8 & 0x00FF00FF;
+    const uint32_t ag = ((a >> 8 & 0x00FF00FF) * (256 - w) + (b >> 8 & 0x00FF00FF) * w) & 0xFF00FF00;
+    return rb | ag;
+}
+
+// Returns the bilinear filtered texel at <u>, <v> (both from 0 to 1) of mip <level> of a <texture>,
+// or of its coarsest mip if it does not hold <level>. Texel positions carry 8 fractional bits.
+static uint32_t bilinear(const Texture texture, const int level, const float u, const float v)
+{
+    const int l = level < texture.coarse ? texture.coarse : level;
+    const int size = side(l);
+    const int mask = size - 1;
+    // Texel centers sit half a texel in.
+    const int fx = u * size * 256.0f - 128.0f;
+    const int fy = v * size * 256.0f - 128.0f;
+    const int x0 = (fx >> 8) & mask;
+    const int y0 = (fy >> 8) & mask;
+    const int x1 = (x0 + 1) & mask;
+    const int y1 = (y0 + 1) & mask;
+    const uint32_t* const texels = mip(texture, l);
+    const uint32_t left = blend(texels[x0 * size + y0], texels[x0 * size + y1], fy & 0xFF);
+    const uint32_t right = blend(texels[x1 * size + y0], texels[x1 * size + y1], fy & 0xFF);
+    return blend(left, right, fx & 0xFF);
+}
+
+// Returns the mip level whose texels best match a pixel covering <texels> texels of the largest mip.
+static int lod(float texels)
+{
+    int l = 0;
+    while(l < MIPS - 1 && texels >= 2.0f)
+    {
+        texels *= 0.5f;
+        l++;
+    }
+    return l;
+}
+
+// Returns the floor or ceiling texel of a <texture> at <where> with <filter>, for a pixel
+// covering <footprint> map units.
+static uint32_t plane(const Texture texture, const Filter filter, const Point where, const float footprint)
+{
+    switch(filter)
+    {
+    default:
+    case NEAREST:
+        return sample(texture, 0, dec(where.x), dec(where.y));
+    case BILINEAR:
+        return bilinear(texture, 0, dec(where.x), dec(where.y));
+    case MIPMAPPED:
+        return bilinear(texture, lod(footprint * TEXSIZE), dec(where.x), dec(where.y));
+    }
+}
+
+// Averages four ARGB texels channel by channel.
+static uint32_t average(const uint32_t a, const uint32_t b, const uint32_t c, const uint32_t d)
+{
+    uint32_t out = 0;
+    for(int shift = 0; shift < 32; shift += 8)
+    {
+        const uint32_t sum = (a >> shift & 0xFF) + (b >> shift & 0xFF) + (c >> shift & 0xFF) + (d >> shift & 0xFF);
+        out |= (sum + 2) / 4 << shift;
+    }
+    return out;
+}
+
+// Box filters mip 0 of <texels> down into all following mips.
+static void mipmap(uint32_t* const texels)
+{
+    uint32_t* src = texels;
+    for(int level = 1; level < MIPS; level++)
+    {
+        const int size = side(level);
+        uint32_t* const dst = src + 4 * size * size;
+        for(int x = 0; x < size; x++)
+        for(int y = 0; y < size; y++)
+        {
+            const int s = 2 * size;
+            dst[x * size + y] = average(
+                src[(2 * x + 0) * s + 2 * y + 0],
+                src[(2 * x + 0) * s + 2 * y + 1],
+                src[(2 * x + 1) * s + 2 * y + 0],
+                src[(2 * x + 1) * s + 2 * y + 1]);
+        }
+        src = dst;
+    }
+}
+
+#ifndef __unix__
+// FNV-1a hash of <bytes> bytes of <data>. Keys the texture cache on the source content
+// where file modification times are not at hand.
+static uint64_t hash(const void* const data, const size_t bytes)
+{
+    const uint8_t* const p = data;
+    uint64_t h = 0xCBF29CE484222325;
+    for(size_t i = 0; i < bytes; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+#endif
+
+// Header of a processed texture cached on disk. Texels follow the header directly.
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t source;
+    uint64_t stamp;
+    uint32_t texels;
+    uint32_t size;
+}
+Blob;
+
+// Bump when the internal texture format changes to invalidate all cached blobs.
+#define BLOBVERSION (2)
+
+// Identifies the source at <path> by its <bytes> and a <stamp> that changes whenever it does.
+// On unix the stamp is its modification time, so a warm start checks its cache without reading the source.
+// Elsewhere the source is read and hashed. Returns false if there is no source.
+static bool identify(const char* const path, uint64_t* const bytes, uint64_t* const stamp)
+{
+#ifdef __unix__
+    struct stat st;
+    if(stat(path, &st) != 0)
+        return false;
+    *bytes = st.st_size;
+    *stamp = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+#else
+    size_t size;
+    void* const source = SDL_LoadFile(path, &size);
+    if(source == NULL)
+        return false;
+    *bytes = size;
+    *stamp = hash(source, size);
+    SDL_free(source);
+    return true;
+#endif
+}
+
+// Copies the processed texels cached at <path> into <texels> if they were made from a source of <bytes> with <stamp>.
+// On unix the cache is mapped straight into memory, so a warm start does no reading or decoding.
+static bool fetch(const char* const path, const uint64_t bytes, const uint64_t stamp, uint32_t* const texels)
+{
+    const Blob expect = { { 'L', 'W', 'T', 'X' }, BLOBVERSION, bytes, stamp, TEXELS, TEXSIZE };
+    const size_t size = sizeof(expect) + TEXELS * sizeof(*texels);
+#ifdef __unix__
+    const int fd = open(path, O_RDONLY);
+    if(fd == -1)
+        return false;
+    struct stat st;
+    void* const base = fstat(fd, &st) == 0 && (size_t) st.st_size == size
+        ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if(base == MAP_FAILED)
+        return false;
+    const bool valid = memcmp(base, &expect, sizeof(expect)) == 0;
+    if(valid)
+        memcpy(texels, (const char*) base + sizeof(expect), TEXELS * sizeof(*texels));
+    munmap(base, size);
+    return valid;
+#else
+    size_t loaded;
+    char* const base = SDL_LoadFile(path, &loaded);
+    if(base == NULL)
+        return false;
+    const bool valid = loaded == size && memcmp(base, &expect, sizeof(expect)) == 0;
+    if(valid)
+        memcpy(texels, base + sizeof(expect), TEXELS * sizeof(*texels));
+    SDL_free(base);
+    return valid;
+#endif
+}
+
+// Caches processed <texels> made from a source of <bytes> with <stamp> at <path>.
+// A read only art directory just means the next start decodes again.
+static void store(const char* const path, const uint64_t bytes, const uint64_t stamp, const uint32_t* const texels)
+{
+    const Blob blob = { { 'L', 'W', 'T', 'X' }, BLOBVERSION, bytes, stamp, TEXELS, TEXSIZE };
+    SDL_RWops* const file = SDL_RWFromFile(path, "wb");
+    if(file == NULL)
+        return;
+    SDL_RWwrite(file, &blob, sizeof(blob), 1);
+    SDL_RWwrite(file, texels, sizeof(*texels), TEXELS);
+    SDL_RWclose(file);
+}
+
+// Decodes a BMP held in memory into <texels> in the internal format:
+// scaled to TEXSIZE, ARGB, column-major, with mips. Returns false if it cannot be decoded.
+static bool decode(const void* const source, const size_t bytes, uint32_t* const texels)
+{
+    SDL_Surface* const bmp = SDL_LoadBMP_RW(SDL_RWFromConstMem(source, bytes), 1);
+    if(bmp == NULL)
+        return false;
+    SDL_Surface* const argb = SDL_ConvertSurfaceFormat(bmp, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_Surface* const scaled = SDL_CreateRGBSurfaceWithFormat(0, TEXSIZE, TEXSIZE, 32, SDL_PIXELFORMAT_ARGB8888);
+    if(argb == NULL || scaled == NULL || SDL_BlitScaled(argb, NULL, scaled, NULL) != 0)
+    {
+        SDL_FreeSurface(scaled);
+        SDL_FreeSurface(argb);
+        SDL_FreeSurface(bmp);
+        return false;
+    }
+    // Transposes rows into columns.
+    for(int y = 0; y < TEXSIZE; y++)
+    {
+        const uint32_t* const row = (const uint32_t*) ((const uint8_t*) scaled->pixels + y * scaled->pitch);
+        for(int x = 0; x < TEXSIZE; x++)
+            texels[x * TEXSIZE + y] = row[x];
+    }
+    mipmap(texels);
+    SDL_FreeSurface(scaled);
+    SDL_FreeSurface(argb);
+    SDL_FreeSurface(bmp);
+    return true;
+}
+
+// Fills <texels> with a flat <pixel>, used for tiles without art.
+static void flat(const uint32_t pixel, uint32_t* const texels)
+{
+    for(int i = 0; i < TEXELS; i++)
+        texels[i] = pixel;
+}
+
+// Loads the texture for <tile> from art/<tile>.bmp into <texels>. The processed result is cached
+// next to the source, keyed by the source's size and stamp, so later starts skip reading and decoding it.
+// Tiles without art, or with art that cannot be decoded, get their flat color.
+static void load(const int tile, uint32_t* const texels)
+{
+    char path[64];
+    char cache[64];
+    snprintf(path, sizeof(path), "art/%d.bmp", tile);
+    snprintf(cache, sizeof(cache), "art/%d.bmp.cache", tile);
+    uint64_t bytes;
+    uint64_t stamp;
+    if(!identify(path, &bytes, &stamp))
+    {
+        flat(color(tile), texels);
+        return;
+    }
+    if(fetch(cache, bytes, stamp, texels))
+        return;
+    size_t size;
+    void* const source = SDL_LoadFile(path, &size);
+    if(source != NULL && decode(source, size, texels))
+        store(cache, bytes, stamp, texels);
+    else
+    {
+        printf("%s: %s\n", path, SDL_GetError());
+        flat(color(tile), texels);
+    }
+    SDL_free(source);
+}
+
+// Returns the texels of atlas <slot>.
+static uint32_t* texels(const Atlas* const atlas, const int slot)
+{
+    return atlas->pages[slot / SLOTS] + slot % SLOTS * TEXELS;
+}
+
+// Loads requested tiles into their atlas slots, off the render loop.
+static int loader(void* const data)
+{
+    Atlas* const atlas = data;
+    for(;;)
+    {
+        SDL_SemWait(atlas->wake);
+        const int tail = SDL_AtomicGet(&atlas->tail);
+        const Request request = atlas->requests[tail % TILES];
+        SDL_AtomicSet(&atlas->tail, tail + 1);
+        load(request.tile, texels(atlas, request.slot));
+        SDL_AtomicSet(&atlas->loaded[request.slot], 1);
+    }
+    return 0;
+}
+
+// Creates an atlas that keeps no more than <budget> bytes of textures resident, and starts its loader.
+// At least one texture is always allowed so that something other than placeholders can be drawn.
+static Atlas* stock(const int budget)
+{
+    Atlas* const atlas = calloc(1, sizeof(*atlas));
+    if(atlas == NULL)
+    {
+        puts("out of memory creating atlas");
+        exit(1);
+    }
+    const int slots = budget / (int) (TEXELS * sizeof(uint32_t));
+    atlas->slots = slots < 1 ? 1 : slots > PAGES * SLOTS ? PAGES * SLOTS : slots;
+    for(int i = 0; i < PAGES * SLOTS; i++)
+        atlas->owner[i] = -1;
+    for(int tile = 0; tile < TILES; tile++)
+    {
+        atlas->slot[tile] = -1;
+        atlas->residency[tile] = ABSENT;
+        atlas->placeholder[tile] = color(tile);
+    }
+    atlas->wake = SDL_CreateSemaphore(0);
+    SDL_Thread* const thread = atlas->wake ? SDL_CreateThread(loader, "loader", atlas) : NULL;
+    if(thread == NULL)
+    {
+        puts(SDL_GetError());
+        exit(1);
+    }
+    SDL_DetachThread(thread);
+    return atlas;
+}
+
+// Returns the texture to draw <tile> with: its slot if resident, else its placeholder.
+static Texture texture(const Atlas* const atlas, const int tile)
+{
+    if(atlas->residency[tile] == RESIDENT)
+    {
+        const Texture texture = { texels(atlas, atlas->slot[tile]), 0 };
+        return texture;
+    }
+    const Texture texture = { &atlas->placeholder[tile], MIPS - 1 };
+    return texture;
+}
+
+// Returns a slot to load into: a free slot, else the least recently seen resident slot that
+// was not seen this frame. Returns -1 if every slot is in use.
+static int evict(Atlas* const atlas)
+{
+    int best = -1;
+    for(int slot = 0; slot < atlas->slots; slot++)
+    {
+        const int owner = atlas->owner[slot];
+        if(owner == -1)
+        {
+            best = slot;
+            break;
+        }
+        if(atlas->residency[owner] == RESIDENT && atlas->seen[slot] != atlas->frame)
+            if(best == -1 || atlas->seen[slot] < atlas->seen[best])
+                best = slot;
+    }
+    if(best == -1)
+        return -1;
+    // Pages are only allocated once a slot in them is first needed, and the last page only holds
+    // the slots the budget allows, so no more than the budget is ever allocated.
+    uint32_t** const page = &atlas->pages[best / SLOTS];
+    if(*page == NULL)
+    {
+        const int rest = atlas->slots - best / SLOTS * SLOTS;
+        const int slots = rest < SLOTS ? rest : SLOTS;
+        *page = malloc(slots * TEXELS * sizeof(**page));
+        if(*page == NULL)
+        {
+            puts("out of memory growing atlas");
+            exit(1);
+        }
+        atlas->allocated += slots;
+    }
+    const int owner = atlas->owner[best];
+    if(owner != -1)
+    {
+        atlas->evictions++;
+        atlas->slot[owner] = -1;
+        atlas->residency[owner] = ABSENT;
+    }
+    return best;
+}
+
+// Marks <tile> as seen this frame, requesting it from the loader if it is absent.
+static void touch(Atlas* const atlas, const int tile)
+{
+    if(atlas->residency[tile] == ABSENT)
+    {
+        const int slot = evict(atlas);
+        if(slot == -1)
+            return;
+        atlas->owner[slot] = tile;
+        atlas->slot[tile] = slot;
+        atlas->residency[tile] = LOADING;
+        const int head = SDL_AtomicGet(&atlas->head);
+        const Request request = { tile, slot };
+        atlas->requests[head % TILES] = request;
+        SDL_AtomicSet(&atlas->head, head + 1);
+        SDL_SemPost(atlas->wake);
+        atlas->misses++;
+    }
+    else
+        atlas->hits++;
+    atlas->seen[atlas->slot[tile]] = atlas->frame;
+}
+
+// Makes textures the loader has finished resident, keeping their coarsest mip as a placeholder
+// for when they are evicted, and starts a new frame.
+static void settle(Atlas* const atlas)
+{
+    for(int tile = 0; tile < TILES; tile++)
+    {
+        const int slot = atlas->slot[tile];
+        if(atlas->residency[tile] == LOADING && SDL_AtomicGet(&atlas->loaded[slot]))
+        {
+            SDL_AtomicSet(&atlas->loaded[slot], 0);
+            atlas->residency[tile] = RESIDENT;
+            const Texture texture = { texels(atlas, slot), 0 };
+            atlas->placeholder[tile] = *mip(texture, MIPS - 1);
+        }
+    }
+    atlas->frame++;
+}
+
+// Returns the number of blocks a level of <span> columns needs for <xres> columns.
+static int blocks(const int xres, const int span)
+{
+    return (xres + span - 1) / span;
+}
+
+// Creates an empty depth hierarchy for <xres> columns.
+static Depth* deepen(const int xres)
+{
+    Depth* const depth = calloc(1, sizeof(*depth));
+    if(depth == NULL || (depth->column = malloc(xres * sizeof(*depth->column))) == NULL)
+    {
+        puts("out of memory creating depth buffer");
+        exit(1);
+    }
+    for(int l = 0; l < SPANS; l++)
+    {
+        depth->near[l] = malloc(blocks(xres, spans[l]) * sizeof(*depth->near[l]));
+        depth->far[l] = malloc(blocks(xres, spans[l]) * sizeof(*depth->far[l]));
+        if(depth->near[l] == NULL || depth->far[l] == NULL)
+        {
+            puts("out of memory creating depth buffer");
+            exit(1);
+        }
+    }
+    depth->xres = xres;
+    return depth;
+}
+
+// Rebuilds the block levels of a <depth> hierarchy from its columns. Each level is built
+// from the one below it, so every column is read once.
+static void pyramid(Depth* const depth)
+{
+    for(int l = 0; l < SPANS; l++)
+    {
+        const int below = l == 0 ? 1 : spans[l - 1];
+        const float* const near = l == 0 ? depth->column : depth->near[l - 1];
+        const float* const far = l == 0 ? depth->column : depth->far[l - 1];
+        const int count = blocks(depth->xres, below);
+        const int per = spans[l] / below;
+        for(int b = 0; b < blocks(depth->xres, spans[l]); b++)
+        {
+            float lo = near[b * per];
+            float hi = far[b * per];
+            for(int i = b * per + 1; i < (b + 1) * per && i < count; i++)
+            {
+                lo = near[i] < lo ? near[i] : lo;
+                hi = far[i] > hi ? far[i] : hi;
+            }
+            depth->near[l][b] = lo;
+            depth->far[l][b] = hi;
+        }
+    }
+}
+
+// Returns how much of something spanning columns <x0> to <x1> inclusive, no nearer than <z>,
+// is covered by walls. Only the finest level where the span falls within two blocks is tested,
+// falling back to the columns themselves when that level cannot decide.
+static Cover cover(Depth* const depth, const int x0, const int x1, const float z)
+{
+    depth->tested++;
+    for(int l = 0; l < SPANS; l++)
+    {
+        const int b0 = x0 / spans[l];
+        const int b1 = x1 / spans[l];
+        if(b1 - b0 > 1)
+            continue;
+        const float far = depth->far[l][b0] > depth->far[l][b1] ? depth->far[l][b0] : depth->far[l][b1];
+        const float near = depth->near[l][b0] < depth->near[l][b1] ? depth->near[l][b0] : depth->near[l][b1];
+        if(z > far)
+        {
+            depth->culled[l]++;
+            return HIDDEN;
+        }
+        if(z < near)
+            return CLEAR;
+        break;
+    }
+    for(int x = x0; x <= x1; x++)
+        if(z < depth->column[x])
+            return PARTIAL;
+    depth->culled[SPANS]++;
+    return HIDDEN;
+}
+
+// Creates a sampler casting <samples> rays per edge column of an <xres> by <yres> screen on <threads> threads,
+// filtering floors and ceilings with <floring> and <ceiling>, and capturing column costs if <costing>.
+static Sampler* supersample(const int samples, const Filter floring, const Filter ceiling, const int xres, const int yres,
+    const int threads, const bool costing)
+{
+    Sampler* const sampler = calloc(1, sizeof(*sampler));
+    if(sampler == NULL
+    || (sampler->hits = malloc(xres * sizeof(*sampler->hits))) == NULL
+    || (sampler->scratch = malloc(threads * samples * yres * sizeof(*sampler->scratch))) == NULL
+    || (costing && (sampler->costs = calloc(xres, sizeof(*sampler->costs))) == NULL))
+    {
+        puts("out of memory creating sampler");
+        exit(1);
+    }
+    sampler->samples = samples;
+    sampler->floring = floring;
+    sampler->ceiling = ceiling;
+    return sampler;
+}
+
+// Hints to the core that the thread is spinning.
+static void relax()
+{
+#ifdef __SSE2__
+    _mm_pause();
+#endif
+}
+
+// Returns a cycle count: the time stamp counter where there is one, else the performance counter.
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return SDL_GetPerformanceCounter();
+#endif
+}
+
+// Pins the calling thread to core <cpu> and runs it SCHED_FIFO at <priority>, if supported.
+// A <cpu> of -1 leaves it unpinned and a <priority> of 0 leaves its scheduling alone.
+// Real time priority usually needs CAP_SYS_NICE or an rtprio limit; without it a warning is printed.
+static void pin(const int cpu, const int priority)
+{
+#ifdef __linux__
+    if(cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) != 0)
+            printf("pool: could not pin to cpu %d\n", cpu);
+    }
+    if(priority > 0)
+    {
+        const struct sched_param param = { .sched_priority = priority };
+        if(sched_setscheduler(0, SCHED_FIFO, &param) != 0)
+            printf("pool: could not set SCHED_FIFO priority %d\n", priority);
+    }
+#else
+    (void) cpu;
+    (void) priority;
+#endif
+}
+
+// Returns the core thread <i> is pinned to by an <affinity>, or -1.
+static int core(const Affinity affinity, const int i)
+{
+    if(affinity.count > 0)
+        return affinity.cores[i % affinity.count];
+    return affinity.pin ? i % SDL_GetCPUCount() : -1;
+}
+
+// Runs a pool worker: spin, then park, until the frame counter moves, then do a part of the job.
+static int work(void* const data)
+{
+    const Worker* const worker = data;
+    Pool* const pool = worker->pool;
+    const int i = worker->index;
+    pin(worker->cpu, worker->priority);
+    int seen = 0;
+    for(;;)
+    {
+        const uint64_t t0 = SDL_GetPerformanceCounter();
+        for(int spins = 0;; spins++)
+        {
+            const int frame = SDL_AtomicGet(&pool->frame);
+            if(frame != seen)
+            {
+                seen = frame;
+                if(i < (frame & 0xFF))
+                    break;
+            }
+            relax();
+            // The clock is checked every so often rather than every spin.
+            if(spins % 64 == 0 && SDL_GetPerformanceCounter() - t0 > pool->spin)
+            {
+                // The dispatcher either sees the parked flag and posts, or the worker sees the new frame.
+                SDL_AtomicSet(&pool->parked[i], 1);
+                if(SDL_AtomicGet(&pool->frame) == seen)
+                    SDL_SemWait(pool->wake[i]);
+                SDL_AtomicSet(&pool->parked[i], 0);
+            }
+        }
+        pool->started[i] = SDL_GetPerformanceCounter() - pool->dispatched;
+        pool->job(pool->data, i, seen & 0xFF);
+        SDL_AtomicAdd(&pool->remaining, -1);
+    }
+    return 0;
+}
+
+// Starts a pool of <threads> threads, counting the calling thread, placed by an <affinity>.
+// A <threads> of 0 starts one thread per core and tunes how many of them work.
+static Pool* hire(const int threads, const Affinity affinity)
+{
+    Pool* const pool = calloc(1, sizeof(*pool));
+    if(pool == NULL)
+    {
+        puts("out of memory creating pool");
+        exit(1);
+    }
+    const int wanted = threads == 0 ? SDL_GetCPUCount() : threads;
+    pool->threads = wanted < 1 ? 1 : wanted > THREADS ? THREADS : wanted;
+    pool->active = pool->threads;
+    pool->tune = threads == 0;
+    pool->trial = -1;
+    // Spins for 100 microseconds before parking.
+    pool->spin = SDL_GetPerformanceFrequency() / 10000;
+    pin(core(affinity, 0), affinity.priority);
+    for(int i = 1; i < pool->threads; i++)
+    {
+        Worker* const worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->cpu = core(affinity, i);
+        worker->priority = affinity.priority;
+        pool->wake[i] = SDL_CreateSemaphore(0);
+        SDL_Thread* const thread = pool->wake[i] ? SDL_CreateThread(work, "worker", worker) : NULL;
+        if(thread == NULL)
+        {
+            puts(SDL_GetError());
+            exit(1);
+        }
+        SDL_DetachThread(thread);
+    }
+    return pool;
+}
+
+// Runs a <job> on <data> split across all threads of a <pool>, returning once every part is done.
+static void dispatch(Pool* const pool, const Job job, void* const data)
+{
+    pool->job = job;
+    pool->data = data;
+    pool->dispatched = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&pool->remaining, pool->active - 1);
+    const unsigned generation = ((unsigned) SDL_AtomicGet(&pool->frame) & ~0xFFu) + 0x100u;
+    SDL_AtomicSet(&pool->frame, (int) (generation | (unsigned) pool->active));
+    for(int i = 1; i < pool->active; i++)
+        if(SDL_AtomicGet(&pool->parked[i]))
+            SDL_SemPost(pool->wake[i]);
+    job(data, 0, pool->active);
+    // The barrier: waits for the slowest worker, yielding the core once past the spin budget
+    // in case a worker shares it.
+    const uint64_t t0 = SDL_GetPerformanceCounter();
+    for(int spins = 0; SDL_AtomicGet(&pool->remaining) > 0; spins++)
+    {
+        relax();
+        if(spins % 64 == 0 && SDL_GetPerformanceCounter() - t0 > pool->spin)
+            SDL_Delay(0);
+    }
+    const uint64_t t1 = SDL_GetPerformanceCounter();
+    pool->waiting += t1 - t0;
+    pool->busy += t1 - pool->dispatched;
+    for(int i = 1; i < pool->active; i++)
+        if(pool->started[i] > pool->latency)
+            pool->latency = pool->started[i];
+}
+
+// Ends a frame of a <pool>, folding the frame's latency and barrier wait into the totals.
+static void lap(Pool* const pool)
+{
+    pool->latencies += pool->latency;
+    pool->waitings += pool->waiting;
+    pool->worst = pool->latency > pool->worst ? pool->latency : pool->worst;
+    pool->latency = 0;
+    pool->waiting = 0;
+    pool->last = pool->busy;
+    pool->busy = 0;
+    pool->frames++;
+}
+
+// Tunes the working thread count of a <pool> for an <xres> by <yres> screen, one frame per call,
+// starting over when the resolution changes. Doubling counts are each timed by their fastest frame;
+// a count is only taken if it is at least a sixth faster than the one taken before it,
+// so that cores are not held for a negligible gain.
+static void tune(Pool* const pool, const int xres, const int yres)
+{
+    if(!pool->tune)
+        return;
+    if(xres != pool->xres || yres != pool->yres)
+    {
+        pool->xres = xres;
+        pool->yres = yres;
+        pool->trial = 0;
+        pool->step = 0;
+        pool->counts[0] = 1;
+        pool->active = 1;
+        return;
+    }
+    if(pool->trial < 0)
+        return;
+    // The frame just ended ran at the trial's count.
+    if(pool->step >= WARMUP && (pool->step == WARMUP || pool->last < pool->fastest[pool->trial]))
+        pool->fastest[pool->trial] = pool->last;
+    if(++pool->step < WARMUP + TRIALS)
+        return;
+    const int count = pool->counts[pool->trial];
+    if(count < pool->threads && pool->trial + 1 < TRIALS)
+    {
+        pool->trial++;
+        pool->step = 0;
+        pool->counts[pool->trial] = 2 * count < pool->threads ? 2 * count : pool->threads;
+        pool->active = pool->counts[pool->trial];
+        return;
+    }
+    // Picks the knee of the scaling curve.
+    int knee = 0;
+    for(int t = 1; t <= pool->trial; t++)
+        if(6 * pool->fastest[t] < 5 * pool->fastest[knee])
+            knee = t;
+    pool->active = pool->counts[knee];
+    const double ms = 1e3 / SDL_GetPerformanceFrequency();
+    printf("pool: tuned %dx%d to %d threads (", xres, yres, pool->active);
+    for(int t = 0; t <= pool->trial; t++)
+        printf("%s%d: %.2f ms", t ? ", " : "", pool->counts[t], pool->fastest[t] * ms);
+    puts(")");
+    pool->trial = -1;
+}
+
+// Prints the mean dispatch to start latency and barrier wait per frame of a <pool>.
+static void gauge(const Pool* const pool)
+{
+    if(pool->active < 2 || pool->frames == 0)
+        return;
+    const double us = 1e6 / SDL_GetPerformanceFrequency();
+    printf("pool: %d threads, per frame start latency %.1f us (worst %.1f us), barrier wait %.1f us\n",
+        pool->active,
+        pool->latencies * us / pool->frames, pool->worst * us, pool->waitings * us / pool->frames);
+}
+
+// Creates an empty frame time ring.
+static Jitter* stopwatch()
+{
+    Jitter* const jitter = calloc(1, sizeof(*jitter));
+    if(jitter == NULL)
+    {
+        puts("out of memory creating stopwatch");
+        exit(1);
+    }
+    return jitter;
+}
+
+// Records and returns the time since the last call, in milliseconds, as a frame time.
+static float tick(Jitter* const jitter)
+{
+    const uint64_t now = SDL_GetPerformanceCounter();
+    const float ms = jitter->last ? 1e3f * (now - jitter->last) / SDL_GetPerformanceFrequency() : 0.0f;
+    if(jitter->last)
+        jitter->ms[jitter->count++ % INTERVALS] = ms;
+    jitter->last = now;
+    return ms;
+}
+
+// Orders frame times for qsort.
+static int faster(const void* const a, const void* const b)
+{
+    const float x = *(const float*) a;
+    const float y = *(const float*) b;
+    return (x > y) - (x < y);
+}
+
+// Prints the median and 99th percentile frame times of a <jitter> ring, and the gap between them.
+static void spread(Jitter* const jitter)
+{
+    const int count = jitter->count < INTERVALS ? jitter->count : INTERVALS;
+    if(count == 0)
+        return;
+    qsort(jitter->ms, count, sizeof(*jitter->ms), faster);
+    const float p50 = jitter->ms[count / 2];
+    const float p99 = jitter->ms[count * 99 / 100];
+    printf("frame: p50 %.2f ms, p99 %.2f ms, jitter %.2f ms over %d frames\n", p50, p99, p99 - p50, count);
+}
+
+// Creates empty stats.
+static Stats* gather()
+{
+    Stats* const stats = calloc(1, sizeof(*stats));
+    if(stats == NULL)
+    {
+        puts("out of memory creating stats");
+        exit(1);
+    }
+    stats->listener = -1;
+    stats->second = SDL_GetPerformanceCounter();
+    return stats;
+}
+
+// Sets <stage> of the last frame to the time since performance counter <t0>, and returns the counter now.
+static uint64_t stage(Stats* const stats, const Stage stage, const uint64_t t0)
+{
+    const uint64_t t1 = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&stats->micros[stage], (int) (1e6 * (t1 - t0) / SDL_GetPerformanceFrequency()));
+    return t1;
+}
+
+// Counts <rays> cast, publishing a rays per second gauge once a second.
+static void count(Stats* const stats, const int rays)
+{
+    stats->counted += rays;
+    const uint64_t now = SDL_GetPerformanceCounter();
+    if(now - stats->second >= SDL_GetPerformanceFrequency())
+    {
+        SDL_AtomicSet(&stats->rays, (int) (stats->counted * (double) SDL_GetPerformanceFrequency() / (now - stats->second)));
+        stats->counted = 0;
+        stats->second = now;
+    }
+}
+
+// Records a frame of <ms> milliseconds, and the state of the <pool> and <atlas> after it.
+static void record(Stats* const stats, const float ms, const Pool* const pool, const Atlas* const atlas)
+{
+    if(ms <= 0.0f)
+        return;
+    int bucket = 0;
+    while(bucket < BUCKETS && ms > buckets[bucket])
+        bucket++;
+    SDL_AtomicAdd(&stats->histogram[bucket], 1);
+    SDL_AtomicLock(&stats->lock);
+    stats->elapsed += (uint64_t) (1e3 * ms + 0.5);
+    SDL_AtomicUnlock(&stats->lock);
+    SDL_AtomicAdd(&stats->frames, 1);
+    SDL_AtomicSet(&stats->threads, pool->active);
+    SDL_AtomicSet(&stats->utilization, (int) (1e6 * pool->last / SDL_GetPerformanceFrequency() / ms));
+    SDL_AtomicSet(&stats->hits, atlas->hits);
+    SDL_AtomicSet(&stats->misses, atlas->misses);
+    SDL_AtomicSet(&stats->evictions, atlas->evictions);
+}
+
+// Writes <stats> in the Prometheus text format into <text>, <size> bytes long, returning the length.
+static int format(Stats* const stats, char* const text, const int size)
+{
+    int n = 0;
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_frame_seconds histogram\n");
+    int cumulative = 0;
+    for(int b = 0; b < BUCKETS; b++)
+    {
+        cumulative += SDL_AtomicGet(&stats->histogram[b]);
+        n += snprintf(text + n, size - n, "littlewolf_frame_seconds_bucket{le=\"%.3f\"} %d\n", buckets[b] / 1e3, cumulative);
+    }
+    const int frames = SDL_AtomicGet(&stats->frames);
+    n += snprintf(text + n, size - n, "littlewolf_frame_seconds_bucket{le=\"+Inf\"} %d\n", frames);
+    SDL_AtomicLock(&stats->lock);
+    const uint64_t elapsed = stats->elapsed;
+    SDL_AtomicUnlock(&stats->lock);
+    n += snprintf(text + n, size - n, "littlewolf_frame_seconds_sum %.6f\n", elapsed / 1e6);
+    n += snprintf(text + n, size - n, "littlewolf_frame_seconds_count %d\n", frames);
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_rays_per_second gauge\nlittlewolf_rays_per_second %d\n",
+        SDL_AtomicGet(&stats->rays));
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_stage_seconds gauge\n");
+    for(Stage s = CASTING; s < STAGES; s++)
+        n += snprintf(text + n, size - n, "littlewolf_stage_seconds{stage=\"%s\"} %.6f\n", stages[s],
+            SDL_AtomicGet(&stats->micros[s]) / 1e6);
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_render_threads gauge\nlittlewolf_render_threads %d\n",
+        SDL_AtomicGet(&stats->threads));
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_render_utilization gauge\nlittlewolf_render_utilization %.3f\n",
+        SDL_AtomicGet(&stats->utilization) / 1e3);
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_memory_bytes gauge\n");
+    for(Subsystem s = LEVELS; s < SUBSYSTEMS; s++)
+        n += snprintf(text + n, size - n, "littlewolf_memory_bytes{subsystem=\"%s\"} %d\n", subsystems[s],
+            SDL_AtomicGet(&stats->memory[s]));
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_frame_bytes gauge\n");
+    for(Stage s = CASTING; s < STAGES; s++)
+        n += snprintf(text + n, size - n,
+            "littlewolf_frame_bytes{stage=\"%s\",direction=\"read\"} %d\n"
+            "littlewolf_frame_bytes{stage=\"%s\",direction=\"written\"} %d\n",
+            stages[s], SDL_AtomicGet(&stats->reads[s]), stages[s], SDL_AtomicGet(&stats->writes[s]));
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_texture_cache_hits_total counter\nlittlewolf_texture_cache_hits_total %d\n",
+        SDL_AtomicGet(&stats->hits));
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_texture_cache_misses_total counter\nlittlewolf_texture_cache_misses_total %d\n",
+        SDL_AtomicGet(&stats->misses));
+    n += snprintf(text + n, size - n, "# TYPE littlewolf_texture_cache_evictions_total counter\nlittlewolf_texture_cache_evictions_total %d\n",
+        SDL_AtomicGet(&stats->evictions));
+    return n < size ? n : size - 1;
+}
+
+#ifdef __unix__
+// Sends all <bytes> of <data> to a <client>, resuming partial sends. False if the client
+// goes away or stops reading for longer than its send timeout.
+static bool deliver(const int client, const char* const data, const int bytes)
+{
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    for(int sent = 0; sent < bytes;)
+    {
+        const ssize_t n = send(client, data + sent, bytes - sent, flags);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+#endif
+
+// Answers every connection to the stats socket with the current stats, as an HTTP response
+// so that curl --unix-socket and Prometheus behind a socket proxy can both scrape it.
+// Clients are served one at a time, so each gets a quarter second to send its request and
+// take the response before it is dropped, and an idle or stuck client cannot block the rest.
+static int serve(void* const data)
+{
+#ifdef __unix__
+    Stats* const stats = data;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    char text[8192];
+    for(;;)
+    {
+        const int client = accept(stats->listener, NULL, NULL);
+        if(client < 0)
+            continue;
+        const struct timeval timeout = { 0, 250000 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        // The request is read and ignored: every path serves the metrics.
+        char request[1024];
+        if(read(client, request, sizeof(request)) > 0)
+        {
+            const int body = format(stats, text, sizeof(text));
+            char head[128];
+            const int n = snprintf(head, sizeof(head),
+                "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", body);
+            if(deliver(client, head, n))
+                deliver(client, text, body);
+        }
+        close(client);
+    }
+#else
+    (void) data;
+#endif
+    return 0;
+}
+
+// Serves <stats> on a Unix domain socket at <path> from a low priority thread.
+static void expose(Stats* const stats, const char* const path)
+{
+#ifdef __unix__
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        puts("stats: socket path too long");
+        exit(1);
+    }
+    strcpy(address.sun_path, path);
+    // A socket left behind by an earlier run is replaced, but nothing else at the path is touched.
+    struct stat st;
+    if(lstat(path, &st) == 0)
+    {
+        if(!S_ISSOCK(st.st_mode))
+        {
+            printf("stats: %s exists and is not a socket\n", path);
+            exit(1);
+        }
+        unlink(path);
+    }
+    stats->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(stats->listener < 0
+    || bind(stats->listener, (const struct sockaddr*) &address, sizeof(address)) != 0
+    || listen(stats->listener, 4) != 0)
+    {
+        printf("stats: could not listen on %s\n", path);
+        exit(1);
+    }
+    SDL_Thread* const thread = SDL_CreateThread(serve, "stats", stats);
+    if(thread == NULL)
+    {
+        puts(SDL_GetError());
+        exit(1);
+    }
+    SDL_DetachThread(thread);
+#else
+    (void) stats;
+    printf("stats: no Unix domain sockets, not serving %s\n", path);
+#endif
+}
+
+// The profiler signal handlers write to.
+static Profiler* profiling;
+
+#ifdef __linux__
+// Captures the stack of the interrupted thread. Only async signal safe calls are made: backtrace
+// is loaded before the first signal, and the ring slot is claimed atomically.
+static void snap(const int signal)
+{
+    (void) signal;
+    const int saved = errno;
+    // The count is unsigned before the modulo, so a session long enough to wrap it still lands inside the ring.
+    Stack* const stack = &profiling->stacks[(unsigned) SDL_AtomicAdd(&profiling->taken, 1) % STACKS];
+    stack->depth = backtrace(stack->frames, DEPTH);
+    errno = saved;
+}
+
+// Counts a SIGUSR1 as a profiler toggle, for the render loop to act on.
+static void poke(const int signal)
+{
+    (void) signal;
+    SDL_AtomicAdd(&profiling->signals, 1);
+}
+
+// Orders folded stack lines for qsort.
+static int alphabetical(const void* const a, const void* const b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Writes the stacks a <profiler> took as folded stacks, outermost frame first, one line per distinct
+// stack with its count. Frames are named module+offset, for addr2line -f -e module offset.
+static void fold(Profiler* const profiler)
+{
+    const unsigned taken = (unsigned) SDL_AtomicGet(&profiler->taken);
+    const int count = taken < STACKS ? (int) taken : STACKS;
+    char** const lines = calloc(count + 1, sizeof(*lines));
+    char path[256];
+    snprintf(path, sizeof(path), "%s-%d.folded", profiler->prefix, profiler->dumps++);
+    FILE* const file = fopen(path, "w");
+    if(lines == NULL || file == NULL)
+    {
+        printf("profile: could not write %s\n", path);
+        free(lines);
+        if(file)
+            fclose(file);
+        return;
+    }
+    int made = 0;
+    for(int i = 0; i < count; i++)
+    {
+        // The handler and the signal trampoline are the two innermost frames.
+        const Stack* const stack = &profiler->stacks[i];
+        if(stack->depth <= 2)
+            continue;
+        char** const symbols = backtrace_symbols(stack->frames + 2, stack->depth - 2);
+        char* const line = calloc(stack->depth - 2, 96);
+        if(symbols == NULL || line == NULL)
+        {
+            free(symbols);
+            free(line);
+            continue;
+        }
+        for(int f = stack->depth - 3; f >= 0; f--)
+        {
+            // Symbols look like path/module(name+0x1f) [0x...] or path/module(+0x1f) [0x...].
+            const char* const open = strchr(symbols[f], '(');
+            const char* const slash = strrchr(symbols[f], '/');
+            const char* const module = slash && (!open || slash < open) ? slash + 1 : symbols[f];
+            const char* const plus = open ? strchr(open, '+') : NULL;
+            const char* const close = plus ? strchr(plus, ')') : NULL;
+            char frame[96];
+            if(open && plus && close && plus > open + 1)
+                snprintf(frame, sizeof(frame), "%.*s", (int) (plus - open - 1), open + 1);
+            else if(open && plus && close)
+                snprintf(frame, sizeof(frame), "%.*s%.*s", (int) (open - module), module, (int) (close - plus), plus);
+            else
+                snprintf(frame, sizeof(frame), "%p", stack->frames[f + 2]);
+            strcat(line, frame);
+            if(f > 0)
+                strcat(line, ";");
+        }
+        free(symbols);
+        lines[made++] = line;
+    }
+    qsort(lines, made, sizeof(*lines), alphabetical);
+    for(int i = 0, run = 1; i < made; i++, run++)
+        if(i + 1 == made || strcmp(lines[i], lines[i + 1]) != 0)
+        {
+            fprintf(file, "%s %d\n", lines[i], run);
+            run = 0;
+        }
+    for(int i = 0; i < made; i++)
+        free(lines[i]);
+    free(lines);
+    fclose(file);
+    printf("profile: %d samples written to %s\n", made, path);
+}
+#endif
+
+// Starts or stops a <profiler>, writing out what it took when stopping.
+static void toggle(Profiler* const profiler)
+{
+#ifdef __linux__
+    const struct timeval period = { 0, profiler->running ? 0 : 1000 };
+    const struct itimerval timer = { period, period };
+    if(profiler->running)
+    {
+        setitimer(ITIMER_PROF, &timer, NULL);
+        profiler->running = false;
+        fold(profiler);
+        return;
+    }
+    if(profiler->stacks == NULL && (profiler->stacks = calloc(STACKS, sizeof(*profiler->stacks))) == NULL)
+    {
+        puts("profile: out of memory");
+        return;
+    }
+    SDL_AtomicSet(&profiler->taken, 0);
+    profiler->running = true;
+    setitimer(ITIMER_PROF, &timer, NULL);
+    puts("profile: started");
+#else
+    (void) profiler;
+    puts("profile: only supported on Linux");
+#endif
+}
+
+// Creates a profiler writing to files starting with <prefix>, and listens for SIGUSR1 to toggle it.
+static Profiler* profiler(const char* const prefix)
+{
+    Profiler* const profiler = calloc(1, sizeof(*profiler));
+    if(profiler == NULL)
+    {
+        puts("out of memory creating profiler");
+        exit(1);
+    }
+    profiler->prefix = prefix;
+    profiling = profiler;
+#ifdef __linux__
+    // The first backtrace loads its unwinder, which is not safe in a signal handler.
+    void* frames[DEPTH];
+    backtrace(frames, DEPTH);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = snap;
+    sigaction(SIGPROF, &action, NULL);
+    action.sa_handler = poke;
+    sigaction(SIGUSR1, &action, NULL);
+#endif
+    return profiler;
+}
+
+// Toggles a <profiler> for every hotkey press, counted by the simulation in <toggles>, and every
+// SIGUSR1 since the last call.
+static void profile(Profiler* const profiler, const int toggles)
+{
+    const int total = toggles + SDL_AtomicGet(&profiler->signals);
+    for(; profiler->toggles < total; profiler->toggles++)
+        toggle(profiler);
+}
+
+// Returns monotonic time in nanoseconds.
+static uint64_t nanos()
+{
+#ifdef __unix__
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+    return (uint64_t) (1e9 * SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency());
+#endif
+}
+
+// Sleeps until monotonic time <until>, in nanoseconds.
+static void snooze(const uint64_t until)
+{
+#ifdef __unix__
+    // Only signals are retried; a clock that cannot be slept on falls back to a plain delay.
+    const struct timespec at = { (time_t) (until / 1000000000), (long) (until % 1000000000) };
+    int error;
+    while((error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL)) == EINTR)
+        continue;
+    if(error == 0)
+        return;
+#endif
+    const uint64_t now = nanos();
+    if(until > now)
+        SDL_Delay((until - now) / 1000000);
+}
+
+// Returns an empty input queue.
+static Queue* queue()
+{
+    Queue* const queue = calloc(1, sizeof(*queue));
+    if(queue == NULL)
+    {
+        puts("out of memory creating input queue");
+        exit(1);
+    }
+    return queue;
+}
+
+// Polls every pending window event into a <queue>. Key repeats are skipped.
+// SDL only pumps events on the thread that made the window, so this is called often on it.
+static void hear(Queue* const queue)
+{
+    SDL_Event event;
+    while(SDL_PollEvent(&event))
+    {
+        const bool key = (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat;
+        if(!key && event.type != SDL_QUIT)
+            continue;
+        const int head = SDL_AtomicGet(&queue->head);
+        if(head - SDL_AtomicGet(&queue->tail) == INPUTS)
+        {
+            queue->dropped++;
+            continue;
+        }
+        const Input input = {
+            nanos(),
+            key ? event.key.keysym.scancode : SDL_SCANCODE_UNKNOWN,
+            event.type == SDL_KEYDOWN,
+            event.type == SDL_QUIT
+        };
+        queue->inputs[head % INPUTS] = input;
+        SDL_AtomicSet(&queue->head, head + 1);
+    }
+}
+
+// Consumes every input of a <queue> for one simulation tick and returns the keys held during it.
+static const uint8_t* drain(Queue* const queue)
+{
+    memcpy(queue->key, queue->held, sizeof(queue->key));
+    const uint64_t now = nanos();
+    for(int tail = SDL_AtomicGet(&queue->tail); tail != SDL_AtomicGet(&queue->head); tail++)
+    {
+        const Input input = queue->inputs[tail % INPUTS];
+        SDL_AtomicSet(&queue->tail, tail + 1);
+        queue->age += now - input.time;
+        queue->events++;
+        if(input.quit || input.key == SDL_SCANCODE_END || input.key == SDL_SCANCODE_ESCAPE)
+            queue->quit = true;
+        queue->held[input.key] = input.down;
+        queue->key[input.key] |= input.down;
+    }
+    return queue->key;
+}
+
+// Prints how many inputs a <queue> carried, their mean age when consumed, and how many were dropped.
+static void lag(const Queue* const queue)
+{
+    if(queue->events == 0)
+        return;
+    printf("input: %d events, %.3f ms old when consumed, %d dropped\n",
+        queue->events, 1e-6 * queue->age / queue->events, queue->dropped);
+}
+
+// Creates a pacer targeting <rate> frames per second, uncapped when 0.
+static Pacer* pacer(const float rate, const float refresh)
+{
+    Pacer* const pacer = calloc(1, sizeof(*pacer));
+    if(pacer == NULL)
+    {
+        puts("out of memory creating pacer");
+        exit(1);
+    }
+    pacer->refresh = refresh;
+    pacer->period = rate > 0.0f ? (uint64_t) (1e9 / rate) : 0;
+    // Sleeps are trusted to within a millisecond; the rest is spun.
+    pacer->spin = 1000000;
+    pacer->deadline = pacer->presented = nanos();
+    return pacer;
+}
+
+// Waits out the rest of a frame of a <pacer>, measuring the frame interval and pacing error.
+// Events are polled into a <queue> every millisecond of the wait.
+static void pace(Pacer* const pacer, Queue* const queue)
+{
+    const uint64_t now = nanos();
+    const double interval = 1e-6 * (now - pacer->presented);
+    pacer->interval = pacer->interval == 0.0 ? interval : 0.95 * pacer->interval + 0.05 * interval;
+    pacer->presented = now;
+    if(pacer->period == 0)
+        return;
+    pacer->deadline += pacer->period;
+    // A frame more than a period late drops the missed deadlines rather than rushing to catch up.
+    if(now > pacer->deadline + pacer->period)
+        pacer->deadline = now;
+    for(uint64_t t = nanos(); pacer->deadline > t + pacer->spin; t = nanos())
+    {
+        const uint64_t nap = t + 1000000;
+        snooze(nap < pacer->deadline - pacer->spin ? nap : pacer->deadline - pacer->spin);
+        hear(queue);
+    }
+    uint64_t woke = nanos();
+    while(woke < pacer->deadline)
+    {
+        relax();
+        woke = nanos();
+    }
+    const uint64_t error = woke - pacer->deadline;
+    pacer->error += error;
+    pacer->worst = error > pacer->worst ? error : pacer->worst;
+    pacer->frames++;
 }
-Map;
 
-// Rotates the player by some radian value.
-static Point turn(const Point a, const float t)
+// Prints the target and measured display interval of a <pacer>, and its mean and worst pacing error.
+static void steady(const Pacer* const pacer)
 {
-    const Point b = { a.x * cosf(t) - a.y * sinf(t), a.x * sinf(t) + a.y * cosf(t) };
-    return b;
+    printf("pace: target %.2f ms, frame interval %.2f ms", 1e-6 * pacer->period, pacer->interval);
+    if(pacer->refresh > 0.0f)
+        printf(", vertical sync every %.2f ms%s", pacer->refresh,
+            1e-6 * pacer->period < 0.99 * pacer->refresh ? " caps the target" : "");
+    if(pacer->frames > 0)
+        printf(", error %.1f us (worst %.1f us)", 1e-3 * pacer->error / pacer->frames, 1e-3 * pacer->worst);
+    putchar('\n');
 }
 
-// Rotates a point 90 degrees.
-static Point rag(const Point a)
+// Prints how many things were culled at each level of a <depth> hierarchy.
+static void tally(const Depth* const depth)
 {
-    const Point b = { -a.y, a.x };
-    return b;
+    if(depth->tested == 0)
+        return;
+    long culled = 0;
+    for(int l = 0; l <= SPANS; l++)
+        culled += depth->culled[l];
+    printf("culled %ld of %ld:", culled, depth->tested);
+    for(int l = 0; l < SPANS; l++)
+        printf(" %ld by %d column blocks,", depth->culled[l], spans[l]);
+    printf(" %ld by columns\n", depth->culled[SPANS]);
 }
 
-// Subtracts two points.
-static Point sub(const Point a, const Point b)
+// Returns a float from 0 to 1 with a xorshift generator.
+static float rng(uint32_t* const seed)
 {
-    const Point c = { a.x - b.x, a.y - b.y };
-    return c;
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return (*seed >> 8) / (float) (1 << 24);
 }
 
-// Adds two points.
-static Point add(const Point a, const Point b)
+// Creates room for <max> particles around the <origin> cell.
+static Particles* swarm(const int max, const Cell origin)
 {
-    const Point c = { a.x + b.x, a.y + b.y };
-    return c;
+    Particles* const particles = calloc(1, sizeof(*particles));
+    if(particles == NULL)
+    {
+        puts("out of memory creating particles");
+        exit(1);
+    }
+    particles->x = malloc(max * sizeof(*particles->x));
+    particles->y = malloc(max * sizeof(*particles->y));
+    particles->z = malloc(max * sizeof(*particles->z));
+    particles->vx = malloc(max * sizeof(*particles->vx));
+    particles->vy = malloc(max * sizeof(*particles->vy));
+    particles->vz = malloc(max * sizeof(*particles->vz));
+    particles->life = malloc(max * sizeof(*particles->life));
+    particles->color = malloc(max * sizeof(*particles->color));
+    if(particles->x == NULL || particles->y == NULL || particles->z == NULL
+    || particles->vx == NULL || particles->vy == NULL || particles->vz == NULL
+    || particles->life == NULL || particles->color == NULL)
+    {
+        puts("out of memory creating particles");
+        exit(1);
+    }
+    particles->origin = origin;
+    particles->max = max;
+    particles->seed = 0x2545F491;
+    return particles;
 }
 
-// Multiplies a point by a scalar value.
-static Point mul(const Point a, const float n)
+// Emits up to <count> particles of <color> at <where> relative to the <cell> and <height>,
+// scattering at up to <speed> for up to <life> frames.
+static void emit(Particles* const particles, const Cell cell, const Point where, const float height,
+    const int count, const float speed, const float life, const uint32_t color)
 {
-    const Point b = { a.x * n, a.y * n };
-    return b;
+    const Point at = {
+        where.x + (cell.x - particles->origin.x),
+        where.y + (cell.y - particles->origin.y),
+    };
+    for(int n = 0; n < count && particles->count < particles->max; n++)
+    {
+        const int i = particles->count++;
+        particles->x[i] = at.x;
+        particles->y[i] = at.y;
+        particles->z[i] = height;
+        particles->vx[i] = speed * (2.0f * rng(&particles->seed) - 1.0f);
+        particles->vy[i] = speed * (2.0f * rng(&particles->seed) - 1.0f);
+        particles->vz[i] = speed * rng(&particles->seed);
+        particles->life[i] = life * (0.5f + 0.5f * rng(&particles->seed));
+        particles->color[i] = color;
+    }
 }
 
-// Returns the magnitude of a point.
-static float mag(const Point a)
+// Advances all particles by one frame. Particles fall, bounce off the floor losing
+// half their speed, and are removed once their life runs out.
+static void update(Particles* const particles)
 {
-    return sqrtf(a.x * a.x + a.y * a.y);
+    const uint64_t t0 = SDL_GetPerformanceCounter();
+    const float gravity = 0.002f;
+    const int count = particles->count;
+    float* const restrict x = particles->x;
+    float* const restrict y = particles->y;
+    float* const restrict z = particles->z;
+    float* const restrict vx = particles->vx;
+    float* const restrict vy = particles->vy;
+    float* const restrict vz = particles->vz;
+    float* const restrict life = particles->life;
+    for(int i = 0; i < count; i++)
+    {
+        vz[i] -= gravity;
+        x[i] += vx[i];
+        y[i] += vy[i];
+        z[i] += vz[i];
+        const bool under = z[i] < 0.0f;
+        z[i] = under ? -z[i] : z[i];
+        vz[i] = under ? -0.5f * vz[i] : vz[i];
+        life[i] -= 1.0f;
+    }
+    // Swaps dead particles out with the last live one.
+    int alive = count;
+    for(int i = 0; i < alive; i++)
+        while(i < alive && life[i] <= 0.0f)
+        {
+            alive--;
+            x[i] = x[alive];
+            y[i] = y[alive];
+            z[i] = z[alive];
+            vx[i] = vx[alive];
+            vy[i] = vy[alive];
+            vz[i] = vz[alive];
+            life[i] = life[alive];
+            particles->color[i] = particles->color[alive];
+        }
+    particles->count = alive;
+    particles->updating += SDL_GetPerformanceCounter() - t0;
+    particles->particles += count;
+    particles->frames++;
 }
 
-// Returns the unit vector of a point.
-static Point unit(const Point a)
+// Splats <particles> into the <display> as small squares seen by the <hero>, the same size
+// a wall texel would be at their distance, up to five pixels across. Each is tested against the wall <depth> hierarchy
+// first, so particles behind walls cost a projection and a comparison or two.
+static void splat(Particles* const particles, const Hero hero, Depth* const depth, const Display display, const int xres, const int yres)
 {
-    return mul(a, 1.0f / mag(a));
+    const uint64_t t0 = SDL_GetPerformanceCounter();
+    const float focal = hero.fov.a.x;
+    const float c = cosf(-hero.theta);
+    const float s = sinf(-hero.theta);
+    // Particle positions relative to the hero.
+    const Point shift = {
+        (particles->origin.x - hero.cell.x) - hero.where.x,
+        (particles->origin.y - hero.cell.y) - hero.where.y,
+    };
+    for(int i = 0; i < particles->count; i++)
+    {
+        const float rx = particles->x[i] + shift.x;
+        const float ry = particles->y[i] + shift.y;
+        const float vx = rx * c - ry * s;
+        const float vy = rx * s + ry * c;
+        if(vx < 1e-1f)
+            continue;
+        const float size = 0.5f * focal * xres / vx;
+        const int column = 0.5f * xres * (vy * focal / vx + 1.0f);
+        const int row = 0.5f * yres + (particles->z[i] - 0.5f) * size;
+        // Near particles are capped to a few pixels so they stay points rather than blobs.
+        const int half = size / TEXSIZE > 2 ? 2 : size / TEXSIZE;
+        const int x0 = column - half < 0 ? 0 : column - half;
+        const int x1 = column + half >= xres ? xres - 1 : column + half;
+        const int y0 = row - half < 0 ? 0 : row - half;
+        const int y1 = row + half >= yres ? yres - 1 : row + half;
+        if(x0 > x1 || y0 > y1)
+            continue;
+        const Cover cv = cover(depth, x0, x1, vx);
+        if(cv == HIDDEN)
+            continue;
+        for(int x = x0; x <= x1; x++)
+            if(cv == CLEAR || vx < depth->column[x])
+                for(int y = y0; y <= y1; y++)
+                    put(display, x, y, particles->color[i]);
+    }
+    particles->splatting += SDL_GetPerformanceCounter() - t0;
 }
 
-// Returns the slope of a point.
-static float slope(const Point a)
+// Prints the particle benchmark results.
+static void benchmark(const Particles* const particles)
 {
-    return a.y / a.x;
+    if(particles->frames == 0)
+        return;
+    const double ms = 1e3 / SDL_GetPerformanceFrequency() / particles->frames;
+    printf("particles: %.0f per frame, update %.3f ms, splat %.3f ms\n",
+        (double) particles->particles / particles->frames, particles->updating * ms, particles->splatting * ms);
 }
 
-// Fast floor (math.h is too slow).
-static int fl(const float x)
+// Fires a spread of pellets when space is held down. Each pellet is a hitscan ray; where they hit
+// is recorded in the <snapshot>'s shots for the renderer to throw sparks from.
+static Hero shoot(Hero hero, Snapshot* const snapshot, const char** const walling, const uint8_t* key)
 {
-    return (int) x - (x < (int) x);
+    if(hero.reload > 0)
+    {
+        hero.reload--;
+        return hero;
+    }
+    if(!key[SDL_SCANCODE_SPACE])
+        return hero;
+    const Point reference = { 1.0f, 0.0f };
+    Point directions[PELLETS];
+    for(int i = 0; i < PELLETS; i++)
+        directions[i] = turn(reference, hero.theta + 0.2f * (i / (PELLETS - 1.0f) - 0.5f));
+    Hit hits[PELLETS];
+    hitscan(hero.cell, hero.where, directions, PELLETS, walling, hits);
+    Shot* const shot = &snapshot->shots[snapshot->fired++ % SHOTS];
+    shot->cell = hero.cell;
+    shot->where = hero.where;
+    for(int i = 0; i < PELLETS; i++)
+        shot->impacts[i] = hits[i].ray;
+    hero.reload = 20;
+    return hero;
 }
 
-// Fast ceil (math.h is too slow).
-static int cl(const float x)
+// Throws sparks off every wall hit by shots of a <snapshot> fired since <fired> shots.
+// Shots too old for the snapshot to remember are skipped.
+static void spark(Particles* const particles, const Snapshot* const snapshot, int* const fired)
 {
-    return (int) x + (x > (int) x);
+    if(snapshot->fired - *fired > SHOTS)
+        *fired = snapshot->fired - SHOTS;
+    for(; *fired < snapshot->fired; (*fired)++)
+    {
+        const Shot* const shot = &snapshot->shots[*fired % SHOTS];
+        // Sparks start just short of the wall so they do not spawn inside it.
+        for(int i = 0; i < PELLETS; i++)
+            emit(particles, shot->cell, add(shot->where, mul(shot->impacts[i], 0.98f)), 0.5f, 16, 0.02f, 30.0f, 0x00FFDD66);
+    }
 }
 
-// Steps horizontally along a square grid.
-static Point sh(const Point a, const Point b)
+// Creates a handoff with every snapshot starting as <first>.
+static Handoff* handoff(const Snapshot first)
 {
-    const float x = b.x > 0.0f ? fl(a.x + 1.0f) : cl(a.x - 1.0f);
-    const float y = slope(b) * (x - a.x) + a.y;
-    const Point c = { x, y };
-    return c;
+    Handoff* const handoff = calloc(1, sizeof(*handoff));
+    if(handoff == NULL)
+    {
+        puts("out of memory creating handoff");
+        exit(1);
+    }
+    for(int i = 0; i < 3; i++)
+        handoff->snapshots[i] = first;
+    SDL_AtomicSet(&handoff->latest, 0);
+    handoff->back = 1;
+    handoff->front = 2;
+    return handoff;
 }
 
-// Steps vertically along a square grid.
-static Point sv(const Point a, const Point b)
+// Publishes a copy of <snapshot> as the latest, taking back whichever snapshot was latest before.
+static void publish(Handoff* const handoff, const Snapshot* const snapshot)
 {
-    const float y = b.y > 0.0f ? fl(a.y + 1.0f) : cl(a.y - 1.0f);
-    const float x = (y - a.y) / slope(b) + a.x;
-    const Point c = { x, y };
-    return c;
+    handoff->snapshots[handoff->back] = *snapshot;
+    handoff->back = SDL_AtomicSet(&handoff->latest, handoff->back | FRESH) & ~FRESH;
 }
 
-// Returns a decimal value of the ascii tile value on the map.
-static int tile(const Point a, const char** const tiles)
+// Returns the latest snapshot published, or the one returned last time if none is newer.
+static const Snapshot* observe(Handoff* const handoff)
 {
-    const int x = a.x;
-    const int y = a.y;
-    return tiles[y][x] - '0';
+    if(SDL_AtomicGet(&handoff->latest) & FRESH)
+        handoff->front = SDL_AtomicSet(&handoff->latest, handoff->front) & ~FRESH;
+    return &handoff->snapshots[handoff->front];
 }
 
-// Floating point decimal.
-static float dec(const float x)
+// Creates a checkpoint holding up to <size> bytes, with nothing saved to it yet.
+static Checkpoint* checkpoint(const size_t size)
 {
-    return x - (int) x;
-}
-
-// Casts a ray from <where> in unit <direction> until a <walling> tile is hit.
-static Hit cast(const Point where, const Point direction, const char** const walling)
-{
-    // Determine whether to step horizontally or vertically on the grid.
-    const Point hor = sh(where, direction);
-    const Point ver = sv(where, direction);
-    const Point ray = mag(sub(hor, where)) < mag(sub(ver, where)) ? hor : ver;
-    // Due to floating point error, the step may not make it to the next grid square.
-    // Three directions (dy, dx, dc) of a tiny step will be added to the ray
-    // depending on if the ray hit a horizontal wall, a vertical wall, or the corner
-    // of two walls, respectively.
-    const Point dc = mul(direction, 0.01f);
-    const Point dx = { dc.x, 0.0f };
-    const Point dy = { 0.0f, dc.y };
-    const Point test = add(ray,
-        // Tiny step for corner of two grid squares.
-        mag(sub(hor, ver)) < 1e-3f ? dc :
-        // Tiny step for vertical grid square.
-        dec(ray.x) == 0.0f ? dx :
-        // Tiny step for a horizontal grid square.
-        dy);
-    const Hit hit = { tile(test, walling), ray };
-    // If a wall was not hit, then continue advancing the ray.
-    return hit.tile ? hit : cast(ray, direction, walling);
+    Checkpoint* const checkpoint = calloc(1, sizeof(*checkpoint));
+    if(checkpoint == NULL)
+    {
+        puts("out of memory creating checkpoint");
+        exit(1);
+    }
+    checkpoint->tape = reserve(size);
+    memset(checkpoint->tape.base, 0, sizeof(Section));
+    return checkpoint;
 }
 
-// Party casting. Returns a percentage of <y> related to <yres> for ceiling and
-// floor casting when lerping the floor or ceiling.
-static float pcast(const float size, const int yres, const int y)
+// Copies <bytes> of <data> to the end of a checkpoint <tape>.
+static void stow(Arena* const tape, const void* const data, const size_t bytes)
 {
-    return size / (2 * (y + 1) - yres);
+    memcpy(carve(tape, bytes), data, bytes);
 }
 
-// Rotates a line by some radian amount.
-static Line rotate(const Line l, const float t)
+// Copies the next <bytes> of a checkpoint <tape> to <data>.
+static void unstow(Arena* const tape, void* const data, const size_t bytes)
 {
-    const Line line = { turn(l.a, t), turn(l.b, t) };
-    return line;
+    memcpy(data, carve(tape, bytes), bytes);
 }
 
-// Linear interpolation.
-static Point lerp(const Line l, const float n)
+// Starts writing a section tagged <magic> to a checkpoint <tape>, replacing whatever it held.
+static void begin(Arena* const tape, const char magic[4])
 {
-    return add(l.a, mul(sub(l.b, l.a), n));
+    Section header = { { 0 }, SAVEVERSION, 0 };
+    memcpy(header.magic, magic, sizeof(header.magic));
+    tape->used = 0;
+    stow(tape, &header, sizeof(header));
 }
 
-// Setups the software gpu.
-static Gpu setup(const int xres, const int yres, const bool vsync)
+// Finishes writing a checkpoint <tape>, recording its length in its header.
+static void seal(Arena* const tape)
 {
-    if (SDL_Init(SDL_INIT_VIDEO) != 0)
-    {
-        puts(SDL_GetError());
-        exit(1);
-    }
-    SDL_Window* const window = SDL_CreateWindow(
-        "littlewolf",
-        SDL_WINDOWPOS_UNDEFINED,
-        SDL_WINDOWPOS_UNDEFINED,
-        xres, yres,
-        SDL_WINDOW_SHOWN);
-    SDL_Renderer* const renderer = SDL_CreateRenderer(
-        window,
-        -1,
-        SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0x0));
-    // Notice the flip between xres and yres.
-    // The texture is 90 degrees flipped on its side for fast cache access.
-    SDL_Texture* const texture = SDL_CreateTexture(
-        renderer,
-        SDL_PIXELFORMAT_ARGB8888,
-        SDL_TEXTUREACCESS_STREAMING,
-        yres, xres);
-    if(window == NULL || renderer == NULL || texture == NULL)
-    {
-        puts(SDL_GetError());
-        exit(1);
-    }
-    const Gpu gpu = { window, renderer, texture, xres, yres };
-    return gpu;
+    Section* const header = (Section*) tape->base;
+    header->bytes = (uint32_t) tape->used;
 }
 
-// Presents the software gpu to the window.
-// Calls the real GPU to rotate texture back 90 degrees before presenting.
-static void present(const Gpu gpu)
+// Starts reading a checkpoint <tape>. False if it does not hold a section tagged <magic> of this version.
+static bool unseal(Arena* const tape, const char magic[4])
 {
-    const SDL_Rect dst = {
-        (gpu.xres - gpu.yres) / 2,
-        (gpu.yres - gpu.xres) / 2,
-        gpu.yres, gpu.xres,
-    };
-    SDL_RenderCopyEx(gpu.renderer, gpu.texture, NULL, &dst, -90, NULL, SDL_FLIP_NONE);
-    SDL_RenderPresent(gpu.renderer);
+    Section header;
+    tape->used = 0;
+    unstow(tape, &header, sizeof(header));
+    return memcmp(header.magic, magic, sizeof(header.magic)) == 0 && header.version == SAVEVERSION
+        && header.bytes <= tape->size;
 }
 
-// Locks the gpu, returning a pointer to video memory.
-static Display lock(const Gpu gpu)
+// Saves the simulation <state> and the walls of every level of a <campaign> to a <checkpoint>.
+static void save(Checkpoint* const checkpoint, const Snapshot* const state, const Campaign* const campaign)
 {
-    void* screen;
-    int pitch;
-    SDL_LockTexture(gpu.texture, NULL, &screen, &pitch);
-    const Display display = { (uint32_t*) screen, pitch / (int) sizeof(uint32_t) };
-    return display;
+    const uint64_t t0 = nanos();
+    begin(&checkpoint->tape, "LWST");
+    stow(&checkpoint->tape, state, sizeof(*state));
+    for(int i = 0; i < campaign->count; i++)
+        stow(&checkpoint->tape, campaign->levels[i].walls, campaign->levels[i].bytes);
+    seal(&checkpoint->tape);
+    checkpoint->saving += nanos() - t0;
+    checkpoint->saves++;
 }
 
-// Places a pixels in gpu video memory.
-static void put(const Display display, const int x, const int y, const uint32_t pixel)
+// Restores the simulation <state> and the walls of every level of a <campaign> from a <checkpoint>.
+// False, leaving both alone, if nothing was saved to it.
+static bool restore(Checkpoint* const checkpoint, Snapshot* const state, Campaign* const campaign)
 {
-    display.pixels[y + x * display.width] = pixel;
+    const uint64_t t0 = nanos();
+    if(!unseal(&checkpoint->tape, "LWST"))
+        return false;
+    // Hotkey presses and quitting are input rather than state, so they carry through a restore.
+    const Snapshot now = *state;
+    unstow(&checkpoint->tape, state, sizeof(*state));
+    state->rewound = state->saves;
+    state->quit = now.quit;
+    state->toggles = now.toggles;
+    state->captures = now.captures;
+    state->saves = now.saves;
+    state->restores = now.restores;
+    state->saved = now.saved;
+    state->restored = now.restored;
+    // Walls that differ from the checkpoint are written back. Nothing changes walls during play yet,
+    // so none do; whatever first changes them must hand the changes to the renderer through the
+    // snapshot instead, as render threads read the walls without synchronizing with this thread.
+    for(int i = 0; i < campaign->count; i++)
+    {
+        Level* const level = &campaign->levels[i];
+        const char* const walls = carve(&checkpoint->tape, level->bytes);
+        if(memcmp(level->walls, walls, level->bytes))
+            memcpy(level->walls, walls, level->bytes);
+    }
+    checkpoint->restoring += nanos() - t0;
+    checkpoint->restores++;
+    return true;
 }
 
-// Unlocks the gpu, making the pointer to video memory ready for presentation
-static void unlock(const Gpu gpu)
+// Saves the <particles> alive at simulation <tick> to a <checkpoint>, to go with the simulation's <save>.
+static void freeze(Checkpoint* const checkpoint, const Particles* const particles, const int tick, const int save)
 {
-    SDL_UnlockTexture(gpu.texture);
+    const uint64_t t0 = nanos();
+    Arena* const tape = &checkpoint->tape;
+    const Swarm swarm = { save, tick, particles->origin, particles->count, particles->seed };
+    const size_t floats = particles->count * sizeof(float);
+    begin(tape, "LWPT");
+    stow(tape, &swarm, sizeof(swarm));
+    stow(tape, particles->x, floats);
+    stow(tape, particles->y, floats);
+    stow(tape, particles->z, floats);
+    stow(tape, particles->vx, floats);
+    stow(tape, particles->vy, floats);
+    stow(tape, particles->vz, floats);
+    stow(tape, particles->life, floats);
+    stow(tape, particles->color, particles->count * sizeof(*particles->color));
+    seal(tape);
+    checkpoint->saving += nanos() - t0;
+    checkpoint->saves++;
 }
 
-// Spins the hero when keys h,l are held down.
-static Hero spin(Hero hero, const uint8_t* key)
+// Restores <particles> from a <checkpoint>, returning the simulation tick they were saved at,
+// or -1, leaving them alone, if none were saved to it to go with the simulation's <save>.
+static int thaw(Checkpoint* const checkpoint, Particles* const particles, const int save)
 {
-    if(key[SDL_SCANCODE_H]) hero.theta -= 0.1f;
-    if(key[SDL_SCANCODE_L]) hero.theta += 0.1f;
-    return hero;
+    const uint64_t t0 = nanos();
+    Arena* const tape = &checkpoint->tape;
+    Swarm swarm;
+    if(!unseal(tape, "LWPT"))
+        return -1;
+    unstow(tape, &swarm, sizeof(swarm));
+    if(swarm.save != save)
+        return -1;
+    const size_t floats = swarm.count * sizeof(float);
+    unstow(tape, particles->x, floats);
+    unstow(tape, particles->y, floats);
+    unstow(tape, particles->z, floats);
+    unstow(tape, particles->vx, floats);
+    unstow(tape, particles->vy, floats);
+    unstow(tape, particles->vz, floats);
+    unstow(tape, particles->life, floats);
+    unstow(tape, particles->color, swarm.count * sizeof(*particles->color));
+    particles->origin = swarm.origin;
+    particles->count = swarm.count;
+    particles->seed = swarm.seed;
+    checkpoint->restoring += nanos() - t0;
+    checkpoint->restores++;
+    return swarm.tick;
 }
 
-// Moves the hero when w,a,s,d are held down. Handles collision detection for the walls.
-static Hero move(Hero hero, const char** const walling, const uint8_t* key)
+// Prints the size of the last section saved to a <checkpoint> for <what>, and how long saving and restoring took.
+static void rollback(const char* const what, const Checkpoint* const checkpoint)
 {
-    const Point last = hero.where, zero = { 0.0f, 0.0f };
-    // Accelerates with key held down.
-    if(key[SDL_SCANCODE_W] || key[SDL_SCANCODE_S] || key[SDL_SCANCODE_D] || key[SDL_SCANCODE_A])
-    {
-        const Point reference = { 1.0f, 0.0f };
-        const Point direction = turn(reference, hero.theta);
-        const Point acceleration = mul(direction, hero.acceleration);
-        if(key[SDL_SCANCODE_W]) hero.velocity = add(hero.velocity, acceleration);
-        if(key[SDL_SCANCODE_S]) hero.velocity = sub(hero.velocity, acceleration);
-        if(key[SDL_SCANCODE_D]) hero.velocity = add(hero.velocity, rag(acceleration));
-        if(key[SDL_SCANCODE_A]) hero.velocity = sub(hero.velocity, rag(acceleration));
-    }
-    // Otherwise, decelerates (exponential decay).
-    else hero.velocity = mul(hero.velocity, 1.0f - hero.acceleration / hero.speed);
-    // Caps velocity if top speed is exceeded.
-    if(mag(hero.velocity) > hero.speed) hero.velocity = mul(unit(hero.velocity), hero.speed);
-    // Moves.
-    hero.where = add(hero.where, hero.velocity);
-    // Sets velocity to zero if there is a collision and puts hero back in bounds.
-    if(tile(hero.where, walling))
-    {
-        hero.velocity = zero;
-        hero.where = last;
-    }
-    return hero;
+    if(checkpoint->saves == 0)
+        return;
+    printf("checkpoint %s: %.1f KiB, %d saves at %.2f us, %d restores at %.2f us\n", what,
+        ((const Section*) checkpoint->tape.base)->bytes / 1024.0,
+        checkpoint->saves, 1e-3 * checkpoint->saving / checkpoint->saves,
+        checkpoint->restores, checkpoint->restores ? 1e-3 * checkpoint->restoring / checkpoint->restores : 0.0);
 }
 
-// Returns a color value (RGB) from a decimal tile value.
-static uint32_t color(const int tile)
+// Runs the simulation at a fixed tick rate, off the render loop: input in, snapshots out.
+static int simulate(void* const data)
 {
-    switch(tile)
+    const Simulation* const simulation = data;
+    const uint64_t period = (uint64_t) (1e9 / simulation->rate);
+    uint64_t next = nanos();
+    Snapshot state = simulation->first;
+    bool held[4] = { false, false, false, false };
+    while(!state.quit)
     {
-    default:
-    case 1: return 0x00AA0000; // Red.
-    case 2: return 0x0000AA00; // Green.
-    case 3: return 0x000000AA; // Blue.
+        const uint8_t* const key = drain(simulation->inputs);
+        // The profiler and cost capture hotkeys count presses rather than time held.
+        state.toggles += key[SDL_SCANCODE_F9] && !held[0];
+        state.captures += key[SDL_SCANCODE_F10] && !held[1];
+        // F5 checkpoints the simulation and F8 rolls it back to the last checkpoint.
+        if(key[SDL_SCANCODE_F5] && !held[2])
+        {
+            state.saves++;
+            state.saved = state.saves + state.restores;
+            save(simulation->checkpoint, &state, simulation->campaign);
+        }
+        if(key[SDL_SCANCODE_F8] && !held[3])
+        {
+            state.restores++;
+            state.restored = state.saves + state.restores;
+            restore(simulation->checkpoint, &state, simulation->campaign);
+        }
+        held[0] = key[SDL_SCANCODE_F9];
+        held[1] = key[SDL_SCANCODE_F10];
+        held[2] = key[SDL_SCANCODE_F5];
+        held[3] = key[SDL_SCANCODE_F8];
+        // Number keys switch to an already loaded level, dropping the hero at its spawn.
+        for(int i = 0; i < simulation->campaign->count; i++)
+            if(key[SDL_SCANCODE_1 + i] && i != state.level)
+            {
+                state.level = i;
+                state.hero = arrive(state.hero, simulation->campaign->levels[i].spawn);
+            }
+        const Map map = simulation->campaign->levels[state.level].map;
+        state.hero = spin(state.hero, key);
+        state.hero = move(state.hero, map.walling, key);
+        state.hero = shoot(state.hero, &state, map.walling, key);
+        state.quit = simulation->inputs->quit;
+        state.tick++;
+        publish(simulation->handoff, &state);
+        // Ticks keep a fixed schedule so game time never stretches: late ticks run back to back until
+        // caught up, and otherwise the thread sleeps rather than spins. Only a stall of more than half
+        // a second, like a debugger break, is written off instead of replayed.
+        next += period;
+        const uint64_t now = nanos();
+        if(now < next)
+            snooze(next);
+        else if(now - next > 30 * period)
+            next = now;
     }
+    return 0;
 }
 
 // Calculates wall size using the <corrected> ray to the wall.
@@ -344,48 +3304,399 @@ static Wall project(const int xres, const int yres, const float focal, const Poi
     return wall;
 }
 
-// Renders the entire scene from the <hero> perspective given a <map> and a software <gpu>.
-static void render(const Hero hero, const Map map, const Gpu gpu)
+// Returns the mip level of a wall <size> pixels tall, the largest mip no taller than the wall.
+static int level(const float size)
 {
-    const int t0 = SDL_GetTicks();
-    const Line camera = rotate(hero.fov, hero.theta);
-    const Display display = lock(gpu);
-    // Ray cast for all columns of the window.
+    int l = 0;
+    while(l < MIPS - 1 && side(l) > size)
+        l++;
+    return l;
+}
+
+// Draws the floor, wall, and ceiling seen by a ray that made <hit> into <out>, a column of <yres> pixels
+// of an <xres> wide screen. Tiles drawn are marked in <seen>.
+static void column(const Hero hero, const Map map, const Atlas* const atlas, const Sampler* const sampler, const Hit hit,
+    const int xres, const int yres, uint32_t* const out, bool* const seen, Cost* const cost)
+{
+    // Floor and ceiling are traced relative to the hero's cell.
+    const Line trace = { hero.where, add(hero.where, hit.ray) };
+    const Point corrected = turn(hit.ray, -hero.theta);
+    const Wall wall = project(xres, yres, hero.fov.a.x, corrected);
+    // Map units one screen column spans per unit of distance, for picking floor and ceiling mips.
+    const float spread = 2.0f / (hero.fov.a.x * xres);
+    const uint64_t t0 = cost ? cycles() : 0;
+    // Renders flooring.
+    Cursor floring = cursor(&map.floring);
+    for(int y = 0; y < wall.bot; y++)
+    {
+        const float n = -pcast(wall.size, yres, y);
+        const Point where = lerp(trace, n);
+        const int tile = step(&floring, hero.cell, where);
+        seen[tile] = true;
+        out[y] = plane(texture(atlas, tile), sampler->floring, where, n * corrected.x * spread);
+    }
+    const uint64_t t1 = cost ? cycles() : 0;
+    // Renders wall. The top of the texture is drawn at the top of the wall.
+    const Texture walling = texture(atlas, hit.tile);
+    const int l = level(wall.size);
+    const float top = 0.5f * (yres + wall.size);
+    seen[hit.tile] = true;
+    for(int y = wall.bot; y < wall.top; y++)
+        out[y] = sample(walling, l, hit.u, (top - y - 0.5f) / wall.size);
+    const uint64_t t2 = cost ? cycles() : 0;
+    // Renders ceiling.
+    Cursor ceiling = cursor(&map.ceiling);
+    for(int y = wall.top; y < yres; y++)
+    {
+        const float n = +pcast(wall.size, yres, y);
+        const Point where = lerp(trace, n);
+        const int tile = step(&ceiling, hero.cell, where);
+        seen[tile] = true;
+        out[y] = plane(texture(atlas, tile), sampler->ceiling, where, n * corrected.x * spread);
+    }
+    // Supersampled columns add up the cost of every sample.
+    if(cost)
+    {
+        const uint64_t t3 = cycles();
+        cost->floring += t1 - t0;
+        cost->wall += t2 - t1;
+        cost->ceiling += t3 - t2;
+    }
+}
+
+// Returns true if column <x> is on a wall edge: a neighbouring column hit a different tile,
+// or a wall more than a tenth nearer or farther.
+static bool edge(const Sampler* const sampler, const Depth* const depth, const int x)
+{
+    for(int n = x - 1; n <= x + 1; n += 2)
+    {
+        if(n < 0 || n >= depth->xres)
+            continue;
+        if(sampler->hits[n].tile != sampler->hits[x].tile
+        || fabsf(depth->column[n] - depth->column[x]) > 0.1f * depth->column[x])
+            return true;
+    }
+    return false;
+}
+
+// Box filters <samples> columns of <yres> pixels, stored back to back in <scratch>, into <out>.
+static void resolve(uint32_t* const restrict out, const uint32_t* const restrict scratch, const int samples, const int yres)
+{
+    for(int y = 0; y < yres; y++)
+    {
+        uint32_t r = 0;
+        uint32_t g = 0;
+        uint32_t b = 0;
+        for(int k = 0; k < samples; k++)
+        {
+            const uint32_t pixel = scratch[k * yres + y];
+            r += pixel >> 16 & 0xFF;
+            g += pixel >> 8 & 0xFF;
+            b += pixel >> 0 & 0xFF;
+        }
+        out[y] = (r / samples) << 16 | (g / samples) << 8 | (b / samples);
+    }
+}
+
+// Ray casts part <part> of <parts> contiguous column ranges of a <data> scene.
+static void trace(void* const data, const int part, const int parts)
+{
+    const Scene* const scene = data;
+    const Hero hero = scene->hero;
+    Cost* const costs = scene->sampler->costs;
+    for(int x = part * scene->xres / parts; x < (part + 1) * scene->xres / parts; x++)
+    {
+        const uint64_t t0 = costs ? cycles() : 0;
+        const Point direction = lerp(scene->camera, x / (float) scene->xres);
+        scene->sampler->hits[x] = cast(hero.cell, hero.where, direction, scene->map.walling);
+        scene->depth->column[x] = turn(scene->sampler->hits[x].ray, -hero.theta).x;
+        if(costs)
+        {
+            const Cost cost = { (uint32_t) (cycles() - t0), 0, 0, 0 };
+            costs[x] = cost;
+        }
+    }
+}
+
+// Draws part <part> of <parts> contiguous column ranges of a <data> scene,
+// casting extra rays spread across the column for edges.
+static void draw(void* const data, const int part, const int parts)
+{
+    Scene* const scene = data;
+    const Hero hero = scene->hero;
+    const Sampler* const sampler = scene->sampler;
+    const int xres = scene->xres;
+    const int yres = scene->yres;
+    uint32_t* const scratch = sampler->scratch + part * sampler->samples * yres;
+    bool* const seen = scene->seen[part];
+    int rays = 0;
+    for(int x = part * xres / parts; x < (part + 1) * xres / parts; x++)
+    {
+        uint32_t* const out = scene->display.pixels + x * scene->display.width;
+        Cost* const cost = sampler->costs ? &sampler->costs[x] : NULL;
+        if(sampler->samples > 1 && edge(sampler, scene->depth, x))
+        {
+            for(int k = 0; k < sampler->samples; k++)
+            {
+                const float offset = (k + 0.5f) / sampler->samples - 0.5f;
+                const uint64_t t0 = cost ? cycles() : 0;
+                const Point direction = lerp(scene->camera, (x + offset) / xres);
+                const Hit hit = cast(hero.cell, hero.where, direction, scene->map.walling);
+                if(cost)
+                    cost->cast += cycles() - t0;
+                column(hero, scene->map, scene->atlas, sampler, hit, xres, yres, scratch + k * yres, seen, cost);
+            }
+            resolve(out, scratch, sampler->samples, yres);
+            rays += sampler->samples;
+        }
+        else
+            column(hero, scene->map, scene->atlas, sampler, sampler->hits[x], xres, yres, out, seen, cost);
+    }
+    // Every column was cast once before drawing.
+    scene->rays[part] = rays + (part + 1) * xres / parts - part * xres / parts;
+}
+
+// Estimates the bytes each stage read and wrote drawing the last frame from the <hero>'s view, from
+// the <sampler>'s hits and the <depth> of each column, and adds them to the <stats>. A ray reads a map
+// row pointer and tile for every cell it crosses, and writes its hit and depth. A floor or ceiling pixel
+// reads a map run and one texel, or four when filtered, a wall pixel reads one texel, and every pixel
+// is written once, plus once more to and from scratch per sample on supersampled edges. A particle
+// reads its eight fields and a depth, and writes about a 3x3 splat. Uploads read and write the frame.
+static void account(Stats* const stats, const Hero hero, const Sampler* const sampler, const Depth* const depth,
+    const Particles* const particles, const Gpu gpu)
+{
+    uint64_t read[STAGES] = { 0 };
+    uint64_t written[STAGES] = { 0 };
+    const uint64_t run = sizeof(char) + sizeof(int);
+    const uint64_t floring = sampler->floring == NEAREST ? sizeof(uint32_t) : 4 * sizeof(uint32_t);
+    const uint64_t ceiling = sampler->ceiling == NEAREST ? sizeof(uint32_t) : 4 * sizeof(uint32_t);
     for(int x = 0; x < gpu.xres; x++)
     {
-        const Point direction = lerp(camera, x / (float) gpu.xres);
-        const Hit hit = cast(hero.where, direction, map.walling);
-        const Point ray = sub(hit.where, hero.where);
-        const Line trace = { hero.where, hit.where };
-        const Point corrected = turn(ray, -hero.theta);
+        const Point ray = sampler->hits[x].ray;
+        const uint64_t cells = 1 + (uint64_t) (fabsf(ray.x) + fabsf(ray.y));
+        const int samples = sampler->samples > 1 && edge(sampler, depth, x) ? sampler->samples : 1;
+        const Point corrected = { depth->column[x], 0.0f };
         const Wall wall = project(gpu.xres, gpu.yres, hero.fov.a.x, corrected);
-        // Renders flooring.
-        for(int y = 0; y < wall.bot; y++)
-            put(display, x, y, color(tile(lerp(trace, -pcast(wall.size, gpu.yres, y)), map.floring)));
-        // Renders wall.
-        for(int y = wall.bot; y < wall.top; y++)
-            put(display, x, y, color(hit.tile));
-        // Renders ceiling.
-        for(int y = wall.top; y < gpu.yres; y++)
-            put(display, x, y, color(tile(lerp(trace, +pcast(wall.size, gpu.yres, y)), map.ceiling)));
+        read[CASTING] += (samples + (samples > 1)) * cells * (sizeof(char*) + sizeof(char));
+        written[CASTING] += sizeof(Hit) + sizeof(float);
+        read[DRAWING] += samples * (wall.bot * (run + floring) + (wall.top - wall.bot) * sizeof(uint32_t)
+            + (gpu.yres - wall.top) * (run + ceiling));
+        written[DRAWING] += gpu.yres * sizeof(uint32_t);
+        // Supersampled columns go through scratch before being resolved.
+        if(samples > 1)
+        {
+            read[DRAWING] += samples * gpu.yres * sizeof(uint32_t);
+            written[DRAWING] += samples * gpu.yres * sizeof(uint32_t);
+        }
     }
+    read[SPLATTING] = (uint64_t) particles->count * (7 * sizeof(float) + sizeof(uint32_t) + sizeof(float))
+        + gpu.xres * sizeof(float);
+    written[SPLATTING] = (uint64_t) particles->count * 9 * sizeof(uint32_t);
+    read[UPLOADING] = written[UPLOADING] = (uint64_t) gpu.xres * gpu.yres * sizeof(uint32_t);
+    for(Stage s = CASTING; s < STAGES; s++)
+    {
+        stats->read[s] += read[s];
+        stats->written[s] += written[s];
+        SDL_AtomicSet(&stats->reads[s], (int) read[s]);
+        SDL_AtomicSet(&stats->writes[s], (int) written[s]);
+    }
+    stats->accounted++;
+}
+
+// Renders the entire scene from the <hero> perspective given a <map>, its <atlas>, and a software <gpu>.
+// Columns on wall edges are supersampled when the <sampler> asks for more than one sample.
+// Casting and drawing are each split across the threads of a <pool>; drawing waits on all casts
+// as edge detection reads neighbouring columns.
+static void render(const Hero hero, const Map map, Atlas* const atlas, Depth* const depth, Particles* const particles,
+    const Sampler* const sampler, const Gpu gpu, Pool* const pool, Stats* const stats)
+{
+    uint64_t t = SDL_GetPerformanceCounter();
+    settle(atlas);
+    Scene scene;
+    scene.hero = hero;
+    scene.map = map;
+    scene.atlas = atlas;
+    scene.depth = depth;
+    scene.sampler = sampler;
+    scene.camera = rotate(hero.fov, hero.theta);
+    scene.display = lock(gpu);
+    scene.xres = gpu.xres;
+    scene.yres = gpu.yres;
+    memset(scene.seen, 0, sizeof(scene.seen));
+    dispatch(pool, trace, &scene);
+    t = stage(stats, CASTING, t);
+    dispatch(pool, draw, &scene);
+    t = stage(stats, DRAWING, t);
+    lap(pool);
+    const Display display = scene.display;
+    bool seen[TILES] = { false };
+    for(int part = 0; part < pool->active; part++)
+    {
+        for(int tile = 0; tile < TILES; tile++)
+            seen[tile] |= scene.seen[part][tile];
+        count(stats, scene.rays[part]);
+    }
+    pyramid(depth);
+    splat(particles, hero, depth, display, gpu.xres, gpu.yres);
+    t = stage(stats, SPLATTING, t);
     unlock(gpu);
+    t = stage(stats, UPLOADING, t);
     present(gpu);
-    // Caps frame rate to ~60 fps if the vertical sync (VSYNC) init failed.
-    const int t1 = SDL_GetTicks();
-    const int ms = 16 - (t1 - t0);
-    SDL_Delay(ms < 0 ? 0 : ms);
+    stage(stats, PRESENTING, t);
+    account(stats, hero, sampler, depth, particles, gpu);
+    // Textures seen this frame are kept resident, or loaded if they were not.
+    for(int tile = 0; tile < TILES; tile++)
+        if(seen[tile])
+            touch(atlas, tile);
 }
 
-static bool done()
+// Sets the bytes allocated by each subsystem in the <stats>: the arenas of the <campaign>'s levels; the <depth> hierarchy,
+// <sampler> with scratch for <threads> threads, and post processing tables derived each frame;
+// the <atlas> pages; the frame buffer and the streaming texture SDL keeps for it, estimated at one frame;
+// the <particles>; and the tapes of the <simulating> and <keeping> checkpoints, reserved in full at start.
+static void weigh(Stats* const stats, const Campaign* const campaign, const Atlas* const atlas, const Depth* const depth,
+    const Sampler* const sampler, const int threads, const Particles* const particles, const Gpu gpu,
+    const Checkpoint* const simulating, const Checkpoint* const keeping)
 {
-    SDL_Event event;
-    SDL_PollEvent(&event);
-    return event.type == SDL_QUIT
-        || event.key.keysym.sym == SDLK_END
-        || event.key.keysym.sym == SDLK_ESCAPE;
+    int levels = 0;
+    for(int i = 0; i < campaign->count; i++)
+        levels += (int) campaign->levels[i].arena.size;
+    SDL_AtomicSet(&stats->memory[LEVELS], levels);
+    int derived = gpu.xres * (int) sizeof(*depth->column) + (int) sizeof(*depth) + (int) sizeof(*sampler);
+    for(int l = 0; l < SPANS; l++)
+        derived += 2 * blocks(gpu.xres, spans[l]) * (int) sizeof(*depth->near[l]);
+    derived += gpu.xres * (int) sizeof(*sampler->hits);
+    derived += threads * sampler->samples * gpu.yres * (int) sizeof(*sampler->scratch);
+    if(sampler->costs)
+        derived += gpu.xres * (int) sizeof(*sampler->costs);
+    if(gpu.post)
+        derived += (int) sizeof(*gpu.post) + (gpu.xres + gpu.yres) * (int) sizeof(*gpu.post->across);
+    SDL_AtomicSet(&stats->memory[DERIVED], derived);
+    SDL_AtomicSet(&stats->memory[TEXTURES], (int) sizeof(*atlas) + atlas->allocated * TEXELS * (int) sizeof(uint32_t));
+    SDL_AtomicSet(&stats->memory[FRAMEBUFFERS], 2 * gpu.xres * gpu.yres * (int) sizeof(*gpu.pixels));
+    SDL_AtomicSet(&stats->memory[PARTICLES], (int) sizeof(*particles) + particles->max * (int) (7 * sizeof(float) + sizeof(uint32_t)));
+    SDL_AtomicSet(&stats->memory[CHECKPOINTS], (int) (2 * sizeof(Checkpoint) + simulating->tape.size + keeping->tape.size));
+}
+
+// Prints the bytes allocated by each subsystem in the <stats>, and the mean bytes each stage read and wrote per frame.
+static void footprint(Stats* const stats)
+{
+    printf("memory:");
+    for(Subsystem s = LEVELS; s < SUBSYSTEMS; s++)
+        printf(" %s %.1f KiB%s", subsystems[s], SDL_AtomicGet(&stats->memory[s]) / 1024.0, s + 1 < SUBSYSTEMS ? "," : "\n");
+    if(stats->accounted == 0)
+        return;
+    printf("traffic per frame:");
+    for(Stage s = CASTING; s < STAGES; s++)
+        printf(" %s %.1f/%.1f KiB%s", stages[s],
+            stats->read[s] / 1024.0 / stats->accounted, stats->written[s] / 1024.0 / stats->accounted,
+            s + 1 < STAGES ? "," : " read/written\n");
+}
+
+// Writes the column costs of the last frame a <sampler> drew on an <xres> wide screen to <prefix>-<n>.csv,
+// and to <prefix>-<n>.bmp as a strip of stacked bars, one per column: cast in red, floor in green,
+// wall in blue, and ceiling in yellow. Bars are scaled to the 99th percentile column so that one
+// preempted column does not flatten the rest; costlier columns are clipped and capped in white.
+static void chart(const Sampler* const sampler, const int xres, const char* const prefix, const int n)
+{
+    if(sampler->costs == NULL)
+    {
+        puts("costs: not capturing, run with --costs prefix");
+        return;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s-%d.csv", prefix, n);
+    FILE* const file = fopen(path, "w");
+    if(file == NULL)
+    {
+        printf("costs: could not write %s\n", path);
+        return;
+    }
+    fprintf(file, "column,cast,floor,wall,ceiling\n");
+    for(int x = 0; x < xres; x++)
+    {
+        const Cost c = sampler->costs[x];
+        fprintf(file, "%d,%u,%u,%u,%u\n", x, c.cast, c.floring, c.wall, c.ceiling);
+    }
+    fclose(file);
+    const int height = 128;
+    uint32_t* const strip = calloc(xres * height, sizeof(*strip));
+    float* const totals = malloc(xres * sizeof(*totals));
+    if(strip == NULL || totals == NULL)
+    {
+        puts("costs: out of memory");
+        free(strip);
+        free(totals);
+        return;
+    }
+    for(int x = 0; x < xres; x++)
+    {
+        const Cost c = sampler->costs[x];
+        totals[x] = (float) c.cast + c.floring + c.wall + c.ceiling;
+    }
+    qsort(totals, xres, sizeof(*totals), faster);
+    const uint64_t most = totals[xres * 99 / 100] < 1.0f ? 1 : (uint64_t) totals[xres * 99 / 100];
+    free(totals);
+    for(int x = 0; x < xres; x++)
+    {
+        const Cost c = sampler->costs[x];
+        const uint32_t parts[] = { c.cast, c.floring, c.wall, c.ceiling };
+        const uint32_t colors[] = { 0x00FF4040, 0x0040FF40, 0x004040FF, 0x00FFFF40 };
+        uint64_t below = 0;
+        for(int p = 0; p < 4; p++)
+        {
+            const int y0 = (int) (height * below / most);
+            below += parts[p];
+            const int y1 = (int) (height * below / most);
+            // Bars grow up from the bottom row.
+            for(int y = y0; y < y1 && y < height; y++)
+                strip[(height - 1 - y) * xres + x] = colors[p];
+        }
+        if(below > most)
+            strip[x] = 0x00FFFFFF;
+    }
+    SDL_Surface* const surface = SDL_CreateRGBSurfaceWithFormatFrom(strip, xres, height, 32, xres * sizeof(*strip),
+        SDL_PIXELFORMAT_ARGB8888);
+    snprintf(path, sizeof(path), "%s-%d.bmp", prefix, n);
+    if(surface == NULL || SDL_SaveBMP(surface, path) != 0)
+        printf("costs: could not write %s\n", path);
+    else
+        printf("costs: wrote %s-%d.csv and %s\n", prefix, n, path);
+    SDL_FreeSurface(surface);
+    free(strip);
 }
 
+// Times drawing every column of the <hero>'s view with each floor and ceiling filter,
+// and prints the mean time per frame of each.
+static void compare(const Hero hero, const Map map, Atlas* const atlas, Sampler* const sampler, const Gpu gpu)
+{
+    // Every texture is loaded first so that filtering, not placeholders, is timed.
+    bool seen[TILES] = { false };
+    for(int tile = 0; tile < TILES; tile++)
+        touch(atlas, tile);
+    for(bool loading = true; loading; SDL_Delay(1))
+    {
+        settle(atlas);
+        loading = false;
+        for(int tile = 0; tile < TILES; tile++)
+            loading |= atlas->residency[tile] == LOADING;
+    }
+    const Line camera = rotate(hero.fov, hero.theta);
+    const Display display = lock(gpu);
+    for(int x = 0; x < gpu.xres; x++)
+        sampler->hits[x] = cast(hero.cell, hero.where, lerp(camera, x / (float) gpu.xres), map.walling);
+    const int frames = 64;
+    for(Filter f = NEAREST; f < FILTERS; f++)
+    {
+        sampler->floring = sampler->ceiling = f;
+        const uint64_t t0 = SDL_GetPerformanceCounter();
+        for(int i = 0; i < frames; i++)
+            for(int x = 0; x < gpu.xres; x++)
+                column(hero, map, atlas, sampler, sampler->hits[x], gpu.xres, gpu.yres, display.pixels + x * display.width, seen, NULL);
+        const double ms = 1e3 * (SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency() / frames;
+        printf("filter: %s %.3f ms\n", filters[f], ms);
+    }
+}
 // Changes the field of view. A focal value of 1.0 is 90 degrees.
 static Line viewport(const float focal)
 {
@@ -396,12 +3707,14 @@ static Line viewport(const float focal)
     return fov;
 }
 
-static Hero born(const float focal)
+static Hero born(const float focal, const Cell spawn)
 {
     const Hero hero = {
         viewport(focal),
-        // Where.
-        { 3.5f, 3.5f },
+        // Cell.
+        spawn,
+        // Where within the cell.
+        { 0.5f, 0.5f },
         // Velocity.
         { 0.0f, 0.0f },
         // Speed.
@@ -409,13 +3722,56 @@ static Hero born(const float focal)
         // Acceleration.
         0.015f,
         // Theta radians.
-        0.0f
+        0.0f,
+        // Reload.
+        0,
     };
     return hero;
 }
 
-// Builds the map. Note the static prefix for the parties. Map lives in .bss in private.
-static Map build()
+// Returns the bytes a level of <layout> carves: both compressed planes, counted run by run, and the wall rows.
+static size_t measure(const Layout layout)
+{
+    const size_t width = strlen(layout.walling[0]);
+    const size_t height = layout.height;
+    return packed(layout.ceiling, layout.height) + packed(layout.floring, layout.height)
+        + padded(height * sizeof(char*)) + padded(height * (width + 1));
+}
+
+// Loads a <level> from its <layout> into a fresh arena, releasing whatever the level held before.
+static void build(Level* const level, const Layout layout)
+{
+    release(&level->arena);
+    level->arena = reserve(measure(layout));
+    Arena* const arena = &level->arena;
+    // Ceiling and floor planes are mostly long runs of the same tile, so they are kept compressed.
+    level->map.ceiling = compress(layout.ceiling, layout.height, arena);
+    level->map.floring = compress(layout.floring, layout.height, arena);
+    // Wall rows are copied in so that the level owns every byte it draws from.
+    const size_t width = strlen(layout.walling[0]);
+    const char** const rows = carve(arena, layout.height * sizeof(*rows));
+    char* const chars = carve(arena, layout.height * (width + 1));
+    for(int y = 0; y < layout.height; y++)
+    {
+        memcpy(chars + y * (width + 1), layout.walling[y], width + 1);
+        rows[y] = chars + y * (width + 1);
+    }
+    level->map.walling = rows;
+    level->walls = chars;
+    level->bytes = layout.height * (width + 1);
+    level->spawn = layout.spawn;
+    memset(level->tiles, 0, sizeof(level->tiles));
+    for(int y = 0; y < layout.height; y++)
+        for(size_t x = 0; x < width; x++)
+        {
+            level->tiles[layout.ceiling[y][x] - '0'] = true;
+            level->tiles[layout.walling[y][x] - '0'] = true;
+            level->tiles[layout.floring[y][x] - '0'] = true;
+        }
+}
+
+// Preloads every level.
+static Campaign* preload()
 {
     static const char* ceiling[] = {
         "111111111111111111111111111111111111111111111",
@@ -444,25 +3800,317 @@ static Map build()
         "122223223232232111111111111111222232232322321",
         "111111111111111111111111111111111111111111111",
     };
-    const Map map = { ceiling, walling, floring };
-    return map;
+    static const char* hall[] = {
+        "3333333333333333",
+        "3222222222222223",
+        "3222222222222223",
+        "3222223333222223",
+        "3222223333222223",
+        "3222222222222223",
+        "3222222222222223",
+        "3222222222222223",
+        "3222222222222223",
+        "3333333333333333",
+    };
+    static const char* pillars[] = {
+        "2222222222222222",
+        "2000000000000002",
+        "2011000000033002",
+        "2010000000003002",
+        "2000001111000002",
+        "2000001111000002",
+        "2030000000001002",
+        "2033000000011002",
+        "2000000000000002",
+        "2222222222222222",
+    };
+    static const char* checks[] = {
+        "3333333333333333",
+        "3232323232323233",
+        "3323232323232323",
+        "3232323232323233",
+        "3323232323232323",
+        "3232323232323233",
+        "3323232323232323",
+        "3232323232323233",
+        "3323232323232323",
+        "3333333333333333",
+    };
+    const Layout layouts[] = {
+        { ceiling, walling, floring, sizeof(walling) / sizeof(*walling), { 3, 3 } },
+        { hall, pillars, checks, sizeof(pillars) / sizeof(*pillars), { 2, 8 } },
+    };
+    Campaign* const campaign = calloc(1, sizeof(*campaign));
+    if(campaign == NULL)
+    {
+        puts("out of memory creating campaign");
+        exit(1);
+    }
+    campaign->count = sizeof(layouts) / sizeof(*layouts);
+    for(int i = 0; i < campaign->count; i++)
+        build(&campaign->levels[i], layouts[i]);
+    return campaign;
+}
+
+// Prints command line usage and exits.
+static void usage(const char* const name)
+{
+    printf("usage: %s [--budget bytes] [--particles count] [--upload auto|copy|stream|update]\n"
+        "       [--aa samples] [--floor nearest|bilinear|mip] [--ceiling nearest|bilinear|mip] [--compare-filters]\n"
+        "       [--gamma value] [--scanlines] [--vignette] [--dither] [--threads count|auto]\n"
+        "       [--pin] [--cores list] [--fifo priority] [--fps rate] [--vsync on|off]\n"
+        "       [--stats socket] [--profile prefix] [--costs prefix]\n", name);
+    exit(1);
+}
+
+// Parses the command line.
+static Options parse(const int argc, char* argv[])
+{
+    Options options = {
+        // Budget.
+        1 << 20,
+        // Particles.
+        0,
+        // Upload.
+        AUTO,
+        // Samples.
+        1,
+        // Floor and ceiling filters, and compare.
+        NEAREST,
+        NEAREST,
+        false,
+        // Gamma.
+        1.0f,
+        // Scanlines, vignette, and dither.
+        false,
+        false,
+        false,
+        // Threads and affinity.
+        1,
+        { false, { 0 }, 0, 0 },
+        // Frame rate and vertical sync.
+        60.0f,
+        true,
+        // Stats socket, profile prefix, and costs prefix.
+        NULL,
+        "profile",
+        NULL,
+    };
+    for(int i = 1; i < argc; i++)
+    {
+        const char* const arg = argv[i];
+        const char* const value = i + 1 < argc ? argv[i + 1] : NULL;
+        if(strcmp(arg, "--budget") == 0 && value)
+            options.budget = atoi(value), i++;
+        else if(strcmp(arg, "--particles") == 0 && value)
+            options.particles = atoi(value), i++;
+        else if(strcmp(arg, "--aa") == 0 && value && atoi(value) >= 1 && atoi(value) <= 16)
+            options.samples = atoi(value), i++;
+        else if((strcmp(arg, "--floor") == 0 || strcmp(arg, "--ceiling") == 0) && value)
+        {
+            Filter filter = FILTERS;
+            for(Filter f = NEAREST; f < FILTERS; f++)
+                if(strcmp(value, filters[f]) == 0)
+                    filter = f;
+            if(filter == FILTERS)
+                usage(argv[0]);
+            if(strcmp(arg, "--floor") == 0)
+                options.floring = filter;
+            else
+                options.ceiling = filter;
+            i++;
+        }
+        else if(strcmp(arg, "--compare-filters") == 0)
+            options.compare = true;
+        else if(strcmp(arg, "--gamma") == 0 && value && atof(value) > 0.0)
+            options.gamma = atof(value), i++;
+        else if(strcmp(arg, "--scanlines") == 0)
+            options.scanlines = true;
+        else if(strcmp(arg, "--vignette") == 0)
+            options.vignette = true;
+        else if(strcmp(arg, "--dither") == 0)
+            options.dither = true;
+        else if(strcmp(arg, "--threads") == 0 && value && strcmp(value, "auto") == 0)
+            options.threads = 0, i++;
+        else if(strcmp(arg, "--threads") == 0 && value && atoi(value) >= 1 && atoi(value) <= THREADS)
+            options.threads = atoi(value), i++;
+        else if(strcmp(arg, "--pin") == 0)
+            options.affinity.pin = true;
+        else if(strcmp(arg, "--cores") == 0 && value)
+        {
+            // A comma separated list, the main thread's core first.
+            const char* next = value;
+            for(options.affinity.count = 0; options.affinity.count < THREADS; next++)
+            {
+                char* end;
+                const long cpu = strtol(next, &end, 10);
+                if(end == next || cpu < 0 || cpu > 1023)
+                    usage(argv[0]);
+                options.affinity.cores[options.affinity.count++] = (int) cpu;
+                next = end;
+                if(*next != ',')
+                    break;
+            }
+            if(*next != '\0')
+                usage(argv[0]);
+            i++;
+        }
+        else if(strcmp(arg, "--stats") == 0 && value)
+            options.stats = value, i++;
+        else if(strcmp(arg, "--profile") == 0 && value)
+            options.profile = value, i++;
+        else if(strcmp(arg, "--costs") == 0 && value)
+            options.costs = value, i++;
+        else if(strcmp(arg, "--fps") == 0 && value && atof(value) >= 0.0)
+            options.fps = atof(value), i++;
+        else if(strcmp(arg, "--vsync") == 0 && value && (strcmp(value, "on") == 0 || strcmp(value, "off") == 0))
+            options.vsync = strcmp(value, "on") == 0, i++;
+        else if(strcmp(arg, "--fifo") == 0 && value && atoi(value) >= 1 && atoi(value) <= 99)
+            options.affinity.priority = atoi(value), i++;
+        else if(strcmp(arg, "--upload") == 0 && value)
+        {
+            options.upload = UPLOADS;
+            for(Upload u = AUTO; u < UPLOADS; u++)
+                if(strcmp(value, uploads[u]) == 0)
+                    options.upload = u;
+            if(options.upload == UPLOADS)
+                usage(argv[0]);
+            i++;
+        }
+        else
+            usage(argv[0]);
+    }
+    return options;
 }
 
 // Get Psyched!
 int main(int argc, char* argv[])
 {
-    (void) argc;
-    (void) argv;
-    const Gpu gpu = setup(700, 400, true);
-    const Map map = build();
-    Hero hero = born(0.8f);
-    while(!done())
+    const Options options = parse(argc, argv);
+    const int xres = 700;
+    const int yres = 400;
+    const Gpu gpu = setup(xres, yres, options.vsync, options.upload, process(options, xres, yres));
+    Campaign* const campaign = preload();
+    Atlas* const atlas = stock(options.budget);
+    Depth* const depth = deepen(gpu.xres);
+    Jitter* const jitter = stopwatch();
+    Pacer* const pacing = pacer(options.fps, options.vsync ? refresh(gpu) : 0.0f);
+    Queue* const inputs = queue();
+    Stats* const stats = gather();
+    Profiler* const sampling = profiler(options.profile);
+    const Hero hero = born(0.8f, campaign->levels[0].spawn);
+    Particles* const particles = swarm(options.particles > 4096 ? options.particles : 4096, hero.cell);
+    const Snapshot first = { hero, { { { 0, 0 }, { 0.0f, 0.0f }, { { 0.0f, 0.0f } } } }, 0, 0, false, 0, 0, 0, 0, 0, 0, 0, 0 };
+    size_t walls = 0;
+    for(int i = 0; i < campaign->count; i++)
+        walls += campaign->levels[i].bytes + ALIGNMENT;
+    Simulation simulation = {
+        first, campaign, inputs, handoff(first), checkpoint(2 * ALIGNMENT + sizeof(Section) + sizeof(Snapshot) + walls), 60.0f
+    };
+    Checkpoint* const keeping = checkpoint(10 * ALIGNMENT + sizeof(Section) + sizeof(Swarm)
+        + particles->max * (7 * sizeof(*particles->x) + sizeof(*particles->color)));
+    // The stats server and the simulation start before the pool places the main thread,
+    // so that neither inherits its core or its real time priority.
+    if(options.stats)
+        expose(stats, options.stats);
+    if(!options.compare)
+    {
+        SDL_Thread* const thread = SDL_CreateThread(simulate, "simulation", &simulation);
+        if(thread == NULL)
+        {
+            puts(SDL_GetError());
+            exit(1);
+        }
+        SDL_DetachThread(thread);
+    }
+    Pool* const pool = hire(options.threads, options.affinity);
+    Sampler* const sampler = supersample(options.samples, options.floring, options.ceiling, gpu.xres, gpu.yres, pool->threads,
+        options.costs != NULL);
+    if(options.compare)
+    {
+        compare(hero, campaign->levels[0].map, atlas, sampler, gpu);
+        return 0;
+    }
+    int fired = 0;
+    int ticked = 0;
+    int captured = 0;
+    int level = 0;
+    int saved = 0;
+    int restored = 0;
+    for(;;)
     {
-        const uint8_t* key = SDL_GetKeyboardState(NULL);
-        hero = spin(hero, key);
-        hero = move(hero, map.walling, key);
-        render(hero, map, gpu);
+        hear(inputs);
+        const Snapshot* const snapshot = observe(simulation.handoff);
+        if(snapshot->quit)
+            break;
+        profile(sampling, snapshot->toggles);
+        // Particles are saved and rolled back in the order the simulation saw the presses, several of which
+        // can land in one frame, and only rolled back to particles saved with the save the simulation rolled
+        // back to. They then catch up to the simulation from the tick they were saved at.
+        const int restores = restored;
+        if(restored < snapshot->restores && snapshot->restored < snapshot->saved)
+        {
+            const int tick = thaw(keeping, particles, snapshot->rewound);
+            ticked = tick == -1 ? ticked : tick;
+            restored = snapshot->restores;
+        }
+        if(saved < snapshot->saves)
+        {
+            freeze(keeping, particles, ticked, snapshot->saves);
+            saved = snapshot->saves;
+        }
+        if(restored < snapshot->restores)
+        {
+            const int tick = thaw(keeping, particles, snapshot->rewound);
+            ticked = tick == -1 ? ticked : tick;
+            restored = snapshot->restores;
+        }
+        if(restored != restores)
+        {
+            fired = snapshot->fired;
+            level = snapshot->level;
+        }
+        // A new level starts without the last one's particles, and asks for its textures up front so they
+        // stream in while placeholders stand in for them.
+        if(snapshot->level != level)
+        {
+            level = snapshot->level;
+            particles->count = 0;
+            for(int tile = 0; tile < TILES; tile++)
+                if(campaign->levels[level].tiles[tile])
+                    touch(atlas, tile);
+        }
+        spark(particles, snapshot, &fired);
+        // The particle benchmark keeps the swarm topped up with sparks around the hero.
+        if(options.particles)
+            emit(particles, snapshot->hero.cell, snapshot->hero.where, 0.5f, options.particles - particles->count, 0.05f, 120.0f, 0x00FFAA00);
+        // Particles step once per simulation tick, catching up at most a few ticks at a time.
+        if(snapshot->tick - ticked > 4)
+            ticked = snapshot->tick - 4;
+        for(; ticked < snapshot->tick; ticked++)
+            update(particles);
+        render(snapshot->hero, campaign->levels[level].map, atlas, depth, particles, sampler, gpu, pool, stats);
+        // Costs are charted for the frame drawn from the first snapshot to count a capture press.
+        for(; captured < snapshot->captures; captured++)
+            chart(sampler, gpu.xres, options.costs, captured);
+        tune(pool, gpu.xres, gpu.yres);
+        pace(pacing, inputs);
+        record(stats, tick(jitter), pool, atlas);
+        weigh(stats, campaign, atlas, depth, sampler, pool->threads, particles, gpu, simulation.checkpoint, keeping);
     }
+    if(sampling->running)
+        toggle(sampling);
+    if(options.particles)
+        benchmark(particles);
+    tally(depth);
+    gauge(pool);
+    spread(jitter);
+    steady(pacing);
+    lag(inputs);
+    rollback("simulation", simulation.checkpoint);
+    rollback("particles", keeping);
+    footprint(stats);
+    bandwidth(gpu);
     // No need to free anything - gives quick exit.
     return 0;
 }